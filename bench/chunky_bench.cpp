@@ -0,0 +1,378 @@
+#include "chunky.h"
+#include "chunkrender.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+enum
+{
+	BENCH_GENERATE_EXITS,
+	BENCH_CONNECT_EXITS,
+	BENCH_CONNECT_EXITS_INNER_LOOP,
+	BENCH_CONNECT_EXITS_GRAND_CENTRAL,
+	BENCH_ROOM_EXPAND,
+	BENCH_ROOM_EXPAND_MAX, // the same from the same skeleton, with chunk_filter_room_expand_max
+	BENCH_ROOM_IN_ROOM,
+	BENCH_ONE_WAY_DOORS,
+	BENCH_BEAUTIFY,
+	BENCH_BOSS_PLACEMENT,
+	BENCH_PROTECT_ROOM,
+	BENCH_WILDLIFE,
+	BENCH_CHEST,
+	BENCH_PIPELINE, // everything from generate_exits to chest on one chunk
+	BENCH_RENDER_PRINTF, // drawing the finished chunk one printf per tile, as print_chunk used to
+	BENCH_RENDER_BUFFER, // drawing it with chunk_render
+	BENCH_FEATURE_SCAN, // finding all doors of the finished chunk by reading every tile
+	BENCH_FEATURE_QUERY, // finding them from the feature bitsets
+	BENCH_TRY_COPY, // trying a filter on a copy of the finished chunk, then throwing it away
+	BENCH_TRY_ROLLBACK, // trying it on the chunk itself in a transaction, then rolling it back
+	BENCH_COUNT
+};
+
+static const char* bench_names[BENCH_COUNT] =
+{
+	"generate_exits",
+	"chunk_filter_connect_exits",
+	"chunk_filter_connect_exits_inner_loop",
+	"chunk_filter_connect_exits_grand_central",
+	"chunk_filter_room_expand",
+	"chunk_filter_room_expand_max",
+	"chunk_filter_room_in_room",
+	"chunk_filter_one_way_doors",
+	"beautify",
+	"chunk_filter_boss_placement",
+	"chunk_filter_protect_room",
+	"chunk_filter_wildlife",
+	"chunk_filter_chest",
+	"pipeline",
+	"render_printf",
+	"render_buffer",
+	"feature_scan",
+	"feature_query",
+	"try_copy",
+	"try_rollback",
+};
+
+static int reps = 200;
+static int warmup = 20;
+static std::vector<int> sizes = { 32, 64, 128, 256 };
+static std::vector<int> chaos_values = { 0, 2, 4 };
+static std::vector<int> openness_values = { 0, 2, 4 };
+static std::string json_file;
+static FILE* devnull = nullptr;
+
+static void usage()
+{
+	printf("chunky_bench command line options\n");
+	printf("-h/--help              This help\n");
+	printf("-r/--reps N            Measured chunks per configuration (default %d)\n", reps);
+	printf("-w/--warmup N          Unmeasured chunks per configuration before measuring (default %d)\n", warmup);
+	printf("-S/--sizes A,B,..      Chunk sizes to test, each must be power-of-two (default 32,64,128,256)\n");
+	printf("-c/--chaos A,B,..      Chaos values to test (default 0,2,4)\n");
+	printf("-o/--openness A,B,..   Openness values to test (default 0,2,4)\n");
+	printf("-j/--json FILE         Also write results as JSON to FILE ('-' for standard output, then the table goes to standard error)\n");
+	exit(-1);
+}
+
+static inline bool match(const char* in, const char* short_form, const char* long_form, int& remaining)
+{
+	if (strcmp(in, short_form) == 0 || strcmp(in, long_form) == 0)
+	{
+		remaining--;
+		return true;
+	}
+	return false;
+}
+
+static int get_int(const char* in, int& remaining)
+{
+	if (remaining == 0)
+	{
+		usage();
+	}
+	remaining--;
+	return atoi(in);
+}
+
+static std::string get_str(const char* in, int& remaining)
+{
+	if (remaining == 0)
+	{
+		usage();
+	}
+	remaining--;
+	return in;
+}
+
+static std::vector<int> get_list(const char* in, int& remaining)
+{
+	std::vector<int> list;
+	std::string v = get_str(in, remaining);
+	for (size_t pos = 0; pos < v.size();)
+	{
+		size_t next = v.find(',', pos);
+		if (next == std::string::npos) next = v.size();
+		list.push_back(atoi(v.substr(pos, next - pos).c_str()));
+		pos = next + 1;
+	}
+	if (list.empty()) usage();
+	return list;
+}
+
+struct bench_config
+{
+	int size;
+	int chaos;
+	int openness;
+};
+
+struct bench_result
+{
+	int filter;
+	bench_config cfg;
+	double mean;
+	uint64_t min;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+};
+
+template<typename F>
+static inline void timed(std::vector<uint64_t>* samples, int id, F f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	const auto end = std::chrono::steady_clock::now();
+	if (samples) samples[id].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+static chunkconfig make_config(const bench_config& bc, int i)
+{
+	seed s(i, i);
+	chunkconfig config(s);
+	config.width = bc.size;
+	config.height = bc.size;
+	config.chaos = bc.chaos;
+	config.openness = bc.openness;
+	config.level_width = 4;
+	config.level_height = 4;
+	config.x = s.roll(0, config.level_width - 1);
+	config.y = s.roll(0, config.level_height - 1);
+	return config;
+}
+
+// The old print_tile, kept as a baseline for chunk_render
+static void printf_tile(FILE* fp, uint8_t t)
+{
+	static const char* legacy[] = { " ", ".", "\x1b[0;36m'", "\x1b[0;36m+", "\x1b[0;36m^", "\x1b[0;36m_", "\x1b[0;36m[", "\x1b[0;36m]", "#",
+		"\x1b[0;90m#", "\x1b[0;90m*", "\x1b[0;34m.", "\x1b[0;91m§", "\x1b[0;91m¤", "\x1b[0;91mI", "\x1b[0;91m~", "\x1b[0;94mA", "\x1b[0;94mS",
+		"\x1b[0;94mG", "\x1b[0;32mt", "\x1b[0;93m&", "\x1b[0;91mB", "\x1b[0;91mL", "\x1b[0;92ms", "\x1b[0;94mT", "d", "\x1b[0;96mS", "\x1b[0;33mw" };
+	fprintf(fp, "%s", legacy[t]);
+	fprintf(fp, "\x1b[0m");
+}
+
+// Same pipeline as the stress tests, timing each step. Pass null samples for warmup runs.
+static void run_once(const bench_config& bc, int i, std::vector<uint64_t>* samples)
+{
+	const chunkconfig config = make_config(bc, i);
+	seed s = config.state;
+	const auto start = std::chrono::steady_clock::now();
+	chunk c(config);
+	timed(samples, BENCH_GENERATE_EXITS, [&] { c.generate_exits(); });
+	timed(samples, BENCH_CONNECT_EXITS, [&] { chunk_filter_connect_exits(c); });
+	const int iter = s.roll(2, 8);
+	timed(samples, BENCH_ROOM_EXPAND, [&] { chunk_filter_room_expand(c, iter, iter + 6); });
+	timed(samples, BENCH_ROOM_IN_ROOM, [&] { chunk_filter_room_in_room(c); });
+	const int threshold = s.roll(0, 4);
+	timed(samples, BENCH_ONE_WAY_DOORS, [&] { chunk_filter_one_way_doors(c, threshold); });
+	timed(samples, BENCH_BEAUTIFY, [&] { c.beautify(); });
+	room* r = nullptr;
+	timed(samples, BENCH_BOSS_PLACEMENT, [&] { r = &chunk_filter_boss_placement(c, 0); });
+	timed(samples, BENCH_PROTECT_ROOM, [&] { chunk_filter_protect_room(c, *r); });
+	timed(samples, BENCH_WILDLIFE, [&] { chunk_filter_wildlife(c); });
+	timed(samples, BENCH_CHEST, [&] { chunk_filter_chest(c); });
+	const auto end = std::chrono::steady_clock::now();
+	if (samples) samples[BENCH_PIPELINE].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+	timed(samples, BENCH_RENDER_PRINTF, [&]
+	{
+		for (int y = 0; y < c.height; y++)
+		{
+			for (int x = 0; x < c.width; x++) printf_tile(devnull, c.at(x, y));
+			fprintf(devnull, "\n");
+		}
+		fflush(devnull);
+	});
+	timed(samples, BENCH_RENDER_BUFFER, [&]
+	{
+		std::string out;
+		chunk_render(out, c, RENDER_ANSI);
+		fwrite(out.data(), 1, out.size(), devnull);
+		fflush(devnull);
+	});
+	volatile int found = 0;
+	timed(samples, BENCH_FEATURE_SCAN, [&]
+	{
+		int n = 0;
+		for (int y = 0; y < c.height; y++) for (int x = 0; x < c.width; x++) if (tile_feature(c.at(x, y)) == FEATURE_DOOR) n += x + y;
+		found = n;
+	});
+	timed(samples, BENCH_FEATURE_QUERY, [&]
+	{
+		int n = 0;
+		c.for_each_feature(FEATURE_DOOR, 0, 0, c.width - 1, c.height - 1, [&n](int x, int y) { n += x + y; });
+		found = n;
+	});
+	(void)found;
+	timed(samples, BENCH_TRY_COPY, [&]
+	{
+		chunk attempt = c;
+		chunk_filter_wildlife(attempt);
+	});
+	timed(samples, BENCH_TRY_ROLLBACK, [&]
+	{
+		c.begin();
+		chunk_filter_wildlife(c);
+		c.rollback();
+	});
+
+	// The specialized connectors need a fresh chunk each
+	chunk c2(config);
+	c2.generate_exits();
+	timed(samples, BENCH_CONNECT_EXITS_INNER_LOOP, [&] { chunk_filter_connect_exits_inner_loop(c2); });
+	chunk c3(config);
+	c3.generate_exits();
+	timed(samples, BENCH_CONNECT_EXITS_GRAND_CENTRAL, [&] { chunk_filter_connect_exits_grand_central(c3); });
+	chunk c4(config);
+	c4.generate_exits();
+	chunk_filter_connect_exits(c4);
+	timed(samples, BENCH_ROOM_EXPAND_MAX, [&] { chunk_filter_room_expand_max(c4, iter, iter + 6); });
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, int p)
+{
+	return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+static void write_json(FILE* fp, const std::vector<bench_result>& results)
+{
+	fprintf(fp, "{\n\t\"benchmark\": \"chunky_bench\",\n\t\"reps\": %d,\n\t\"warmup\": %d,\n\t\"results\": [\n", reps, warmup);
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const bench_result& r = results[i];
+		const double tiles = (double)r.cfg.size * r.cfg.size;
+		fprintf(fp, "\t\t{ \"filter\": \"%s\", \"width\": %d, \"height\": %d, \"chaos\": %d, \"openness\": %d, \"samples\": %d, "
+		        "\"mean_ns\": %.1f, \"min_ns\": %llu, \"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"chunks_per_sec\": %.1f, \"ns_per_tile\": %.3f }%s\n",
+		        bench_names[r.filter], r.cfg.size, r.cfg.size, r.cfg.chaos, r.cfg.openness, reps, r.mean, (unsigned long long)r.min,
+		        (unsigned long long)r.p50, (unsigned long long)r.p90, (unsigned long long)r.p99, r.mean > 0.0 ? 1e9 / r.mean : 0.0,
+		        r.mean / tiles, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fp, "\t]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	int remaining = argc - 1; // zeroth is name of program
+	for (int i = 1; i < argc; i++)
+	{
+		if (match(argv[i], "-h", "--help", remaining))
+		{
+			usage();
+		}
+		else if (match(argv[i], "-r", "--reps", remaining))
+		{
+			reps = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-w", "--warmup", remaining))
+		{
+			warmup = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-S", "--sizes", remaining))
+		{
+			sizes = get_list(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-c", "--chaos", remaining))
+		{
+			chaos_values = get_list(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-o", "--openness", remaining))
+		{
+			openness_values = get_list(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-j", "--json", remaining))
+		{
+			json_file = get_str(argv[++i], remaining);
+		}
+	}
+	if (remaining > 0 || reps < 1 || warmup < 0) usage();
+	for (int size : sizes)
+	{
+		if (size < 32 || !ispow2(size))
+		{
+			printf("Chunk sizes must be power-of-two and at least 32!\n");
+			exit(-1);
+		}
+	}
+
+	devnull = fopen("/dev/null", "w");
+	if (!devnull)
+	{
+		printf("Could not open /dev/null!\n");
+		exit(-1);
+	}
+
+	std::vector<bench_result> results;
+	FILE* table = (json_file == "-") ? stderr : stdout; // keep standard output parseable
+	fprintf(table, "%-42s %5s %5s %8s %12s %12s %12s %12s %12s %10s\n", "filter", "size", "chaos", "openness", "mean ns", "p50 ns", "p90 ns", "p99 ns", "chunks/s", "ns/tile");
+	for (int size : sizes)
+	{
+		for (int chaos : chaos_values)
+		{
+			for (int openness : openness_values)
+			{
+				const bench_config bc = { size, chaos, openness };
+				std::vector<uint64_t> samples[BENCH_COUNT];
+				for (int i = 0; i < warmup; i++) run_once(bc, reps + i, nullptr);
+				for (int i = 0; i < reps; i++) run_once(bc, i, samples);
+				for (int f = 0; f < BENCH_COUNT; f++)
+				{
+					std::vector<uint64_t>& v = samples[f];
+					std::sort(v.begin(), v.end());
+					double sum = 0.0;
+					for (uint64_t ns : v) sum += ns;
+					const bench_result r = { f, bc, sum / v.size(), v.front(), percentile(v, 50), percentile(v, 90), percentile(v, 99) };
+					results.push_back(r);
+					fprintf(table, "%-42s %5d %5d %8d %12.1f %12llu %12llu %12llu %12.1f %10.3f\n", bench_names[f], size, chaos, openness, r.mean,
+					       (unsigned long long)r.p50, (unsigned long long)r.p90, (unsigned long long)r.p99, r.mean > 0.0 ? 1e9 / r.mean : 0.0,
+					       r.mean / ((double)size * size));
+				}
+			}
+		}
+	}
+
+	if (json_file == "-")
+	{
+		write_json(stdout, results);
+	}
+	else if (!json_file.empty())
+	{
+		FILE* fp = fopen(json_file.c_str(), "w");
+		if (!fp)
+		{
+			printf("Could not open %s for writing!\n", json_file.c_str());
+			exit(-1);
+		}
+		write_json(fp, results);
+		fclose(fp);
+	}
+
+	return 0;
+}
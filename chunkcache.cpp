@@ -0,0 +1,224 @@
+#include "chunkcache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+struct chunkcache_entry
+{
+	chunkcache_entry(const chunkconfig& cfg) : c(std::make_shared<chunk>(cfg)) {}
+	std::shared_ptr<chunk> c; // current version, protected by the shard lock
+	std::atomic<int> pins{0};
+	int detail = DETAIL_NONE; // protected by the shard lock
+	bool busy = false; // someone is generating or upgrading it, protected by the shard lock
+	uint64_t last_used = 0; // when it was last pinned, protected by the shard lock
+};
+
+void chunkcache_generate(chunk& c, int from, int to)
+{
+	if (from < DETAIL_SKELETON && to >= DETAIL_SKELETON)
+	{
+		c.generate_exits();
+		chunk_filter_connect_exits(c);
+	}
+	if (from < DETAIL_ROOMS && to >= DETAIL_ROOMS)
+	{
+		chunk_filter_room_expand(c);
+		chunk_filter_one_way_doors(c, c.roll(0, 2));
+	}
+	if (from < DETAIL_FULL && to >= DETAIL_FULL)
+	{
+		chunk_filter_chest(c);
+		if (c.config.floors > 1) chunk_filter_stairs(c);
+	}
+}
+
+void chunkpin::release()
+{
+	if (_entry) _entry->pins.fetch_sub(1, std::memory_order_release);
+	_entry = nullptr;
+	_chunk.reset();
+	_detail = DETAIL_NONE;
+}
+
+chunkcache::chunkcache(const chunkconfig& c, chunk_generator gen) : _config(c), _generator(gen)
+{
+}
+
+chunkcache::~chunkcache()
+{
+#ifndef NDEBUG
+	for (const shard& s : _shards) for (const auto& it : s.entries) assert(it.second->pins.load() == 0); // all pins must be released first
+#endif
+}
+
+void chunkcache::forget_packed(const chunk& c)
+{
+	_packed.fetch_sub(1, std::memory_order_relaxed);
+	_packed_raw_bytes.fetch_sub(c.width * c.height, std::memory_order_relaxed);
+	_packed_bytes.fetch_sub(c.map_bytes(), std::memory_order_relaxed);
+}
+
+void chunkcache::inflate(chunkcache_entry* e)
+{
+	// Only unpinned chunks are packed, so nobody else can be looking at it
+	if (!e->c->packed()) return;
+	const auto start = std::chrono::steady_clock::now();
+	forget_packed(*e->c);
+	e->c->unpack();
+	_inflations.fetch_add(1, std::memory_order_relaxed);
+	_inflate_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+}
+
+chunkpin chunkcache::pin(coords pos, int detail)
+{
+	assert(detail > DETAIL_NONE && detail <= DETAIL_FULL);
+	shard& s = shard_for(pos);
+	std::unique_lock<std::mutex> guard(s.lock);
+	auto it = s.entries.find(pos);
+	if (it == s.entries.end())
+	{
+		chunkconfig fresh_config = _config;
+		fresh_config.x = pos.x;
+		fresh_config.y = pos.y;
+		fresh_config.z = pos.z;
+		it = s.entries.emplace(pos, std::unique_ptr<chunkcache_entry>(new chunkcache_entry(fresh_config))).first;
+		_size.fetch_add(1, std::memory_order_relaxed);
+	}
+	chunkcache_entry* e = it->second.get();
+	e->pins.fetch_add(1, std::memory_order_relaxed);
+	e->last_used = tick();
+	s.ready.wait(guard, [e] { return !e->busy; }); // someone else may be generating it right now
+	inflate(e);
+	if (e->detail >= detail) return chunkpin(e, e->c, e->detail);
+
+	// Generate or upgrade it ourselves, without holding the lock. If anyone holds a pin to the current
+	// version, work on a copy so that we do not change the chunk under their feet.
+	const int from = e->detail;
+	std::shared_ptr<chunk> next = (e->c.use_count() == 1) ? e->c : std::make_shared<chunk>(*e->c);
+	e->busy = true;
+	guard.unlock();
+
+	{
+		chunk_trace_scope trace(from == DETAIL_NONE ? "generate chunk" : "upgrade chunk", next.get());
+#ifdef CHUNKY_STATS
+		next->stats_shared = false; // ours alone until handed out below
+#endif
+		_generator(*next, from, detail);
+		next->build_mip();
+#ifdef CHUNKY_STATS
+		next->stats_shared = true;
+#endif
+	}
+	if (from == DETAIL_NONE) _generated.fetch_add(1, std::memory_order_relaxed);
+	else _upgraded.fetch_add(1, std::memory_order_relaxed);
+
+	guard.lock();
+	e->c = next;
+	e->detail = detail;
+	e->busy = false;
+	guard.unlock();
+	s.ready.notify_all();
+	return chunkpin(e, next, detail);
+}
+
+chunkpin chunkcache::find(coords pos)
+{
+	shard& s = shard_for(pos);
+	std::unique_lock<std::mutex> guard(s.lock);
+	auto it = s.entries.find(pos);
+	if (it == s.entries.end()) return chunkpin();
+	chunkcache_entry* e = it->second.get();
+	e->pins.fetch_add(1, std::memory_order_relaxed);
+	e->last_used = tick();
+	s.ready.wait(guard, [e] { return !e->busy; });
+	if (e->detail == DETAIL_NONE) { e->pins.fetch_sub(1, std::memory_order_relaxed); return chunkpin(); }
+	inflate(e);
+	return chunkpin(e, e->c, e->detail);
+}
+
+bool chunkcache::pack(coords pos)
+{
+	shard& s = shard_for(pos);
+	std::lock_guard<std::mutex> guard(s.lock);
+	auto it = s.entries.find(pos);
+	if (it == s.entries.end()) return false;
+	chunkcache_entry* e = it->second.get();
+	// New pins are only taken under the shard lock, so an unpinned entry stays unpinned here
+	if (e->busy || e->detail == DETAIL_NONE || e->pins.load(std::memory_order_acquire) != 0 || e->c->packed()) return false;
+	if (!e->c->pack()) return false;
+	_packed.fetch_add(1, std::memory_order_relaxed);
+	_packed_raw_bytes.fetch_add(e->c->width * e->c->height, std::memory_order_relaxed);
+	_packed_bytes.fetch_add(e->c->map_bytes(), std::memory_order_relaxed);
+	return true;
+}
+
+size_t chunkcache::evict_unpinned()
+{
+	size_t count = 0;
+	for (shard& s : _shards)
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		for (auto it = s.entries.begin(); it != s.entries.end();)
+		{
+			// New pins are only taken under the shard lock, so an unpinned entry stays unpinned here
+			if (!it->second->busy && it->second->pins.load(std::memory_order_acquire) == 0)
+			{
+				erase(it++);
+				count++;
+			}
+			else ++it;
+		}
+	}
+	return count;
+}
+
+void chunkcache::erase(std::unordered_map<coords, std::unique_ptr<chunkcache_entry>>::iterator it)
+{
+	if (it->second->c->packed()) forget_packed(*it->second->c);
+	shard_for(it->first).entries.erase(it);
+	_size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t chunkcache::trim()
+{
+	const size_t budget = _budget.load(std::memory_order_relaxed);
+	if (budget == 0 || size() <= budget) return 0;
+
+	// Find the oldest unpinned chunks first, then evict them one shard at a time, skipping any that were
+	// pinned again in the meantime
+	std::vector<std::pair<uint64_t, coords>> candidates;
+	for (shard& s : _shards)
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		for (const auto& it : s.entries)
+		{
+			if (!it.second->busy && it.second->pins.load(std::memory_order_acquire) == 0) candidates.push_back({ it.second->last_used, it.first });
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<uint64_t, coords>& a, const std::pair<uint64_t, coords>& b) { return a.first < b.first; });
+	size_t count = 0;
+	for (const auto& candidate : candidates)
+	{
+		if (size() <= budget) break;
+		shard& s = shard_for(candidate.second);
+		std::lock_guard<std::mutex> guard(s.lock);
+		auto it = s.entries.find(candidate.second);
+		if (it == s.entries.end() || it->second->busy || it->second->last_used != candidate.first || it->second->pins.load(std::memory_order_acquire) != 0) continue;
+		erase(it);
+		count++;
+	}
+	_evicted.fetch_add(count, std::memory_order_relaxed);
+	return count;
+}
+
+chunkcache_packing chunkcache::packing() const
+{
+	chunkcache_packing p;
+	p.packed = _packed.load(std::memory_order_relaxed);
+	p.raw_bytes = _packed_raw_bytes.load(std::memory_order_relaxed);
+	p.packed_bytes = _packed_bytes.load(std::memory_order_relaxed);
+	p.inflations = _inflations.load(std::memory_order_relaxed);
+	p.inflate_ns = _inflate_ns.load(std::memory_order_relaxed);
+	return p;
+}
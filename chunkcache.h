@@ -0,0 +1,183 @@
+// Chunkcache - shared, thread-safe store of generated chunks
+
+#pragma once
+
+#include "chunky.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct coords
+{
+	int64_t x;
+	int64_t y;
+	int z = 0; // floor, for chunk coordinates
+
+	bool operator<(const coords& other) const { if (z != other.z) { return z < other.z; } if (x != other.x) { return x < other.x; } return y < other.y; }
+	bool operator==(const coords& other) const { return x == other.x && y == other.y && z == other.z; }
+};
+template<> struct std::hash<coords>
+{
+	size_t operator()(const coords& cc) const
+	{
+		return std::hash<int64_t>()(cc.x) ^ (std::hash<int64_t>()(cc.y) << 1) ^ (std::hash<int>()(cc.z) << 2);
+	}
+};
+
+/// How far along the generation pipeline a chunk has come. Each level includes everything before it.
+enum chunk_detail
+{
+	DETAIL_NONE = 0,
+	DETAIL_SKELETON = 1, // exits and the corridors connecting them, enough for minimaps and pathfinding
+	DETAIL_ROOMS = 2, // rooms and doors
+	DETAIL_FULL = 3, // population
+};
+
+/// Function that brings a chunk from detail level 'from' up to detail level 'to'. The chunk config already has its
+/// position set. Upgrading a chunk in several steps must give the exact same chunk as doing it in one go.
+typedef void (*chunk_generator)(chunk& c, int from, int to);
+
+/// The generation pipeline used by chunkview.
+void chunkcache_generate(chunk& c, int from = DETAIL_NONE, int to = DETAIL_FULL);
+
+struct chunkcache;
+struct chunkcache_entry;
+
+/// A reference counted handle to a chunk in a chunkcache. While you hold a pin, the chunk stays
+/// resident and its address stays valid. If someone asks the cache for a higher detail level of
+/// the same chunk, they get an upgraded copy, while your pin keeps pointing to the version you
+/// were given. Pins are move-only.
+struct chunkpin
+{
+	chunkpin() {}
+	chunkpin(chunkpin&& other) : _entry(other._entry), _chunk(std::move(other._chunk)), _detail(other._detail) { other._entry = nullptr; }
+	chunkpin& operator=(chunkpin&& other) { if (this != &other) { release(); _entry = other._entry; _chunk = std::move(other._chunk); _detail = other._detail; other._entry = nullptr; } return *this; }
+	chunkpin(const chunkpin&) = delete;
+	chunkpin& operator=(const chunkpin&) = delete;
+	~chunkpin() { release(); }
+
+	/// Drop our reference. The chunk may be evicted afterwards.
+	void release();
+
+	chunk* get() const { return _chunk.get(); }
+	chunk* operator->() const { return get(); }
+	chunk& operator*() const { return *get(); }
+	explicit operator bool() const { return _entry != nullptr; }
+
+	/// Detail level of the chunk version we hold.
+	int detail() const { return _detail; }
+
+private:
+	friend struct chunkcache;
+	chunkpin(chunkcache_entry* e, const std::shared_ptr<chunk>& c, int detail) : _entry(e), _chunk(c), _detail(detail) {}
+	chunkcache_entry* _entry = nullptr;
+	std::shared_ptr<chunk> _chunk;
+	int _detail = DETAIL_NONE;
+};
+
+/// Memory saved by packing idle chunks, and what it cost to unpack them again.
+struct chunkcache_packing
+{
+	size_t packed = 0; // chunks currently packed
+	size_t raw_bytes = 0; // tile bytes those chunks would use unpacked
+	size_t packed_bytes = 0; // tile bytes they use packed
+	size_t inflations = 0; // chunks unpacked again over the lifetime of the cache
+	uint64_t inflate_ns = 0; // total time spent unpacking them
+
+	double ratio() const { return packed_bytes ? (double)raw_bytes / packed_bytes : 1.0; }
+	double inflate_us() const { return inflations ? inflate_ns / 1000.0 / inflations : 0.0; }
+};
+
+/// A chunk store that can be shared between many chunkviews, possibly running on different threads.
+/// Lookups take one of many shard locks, and each chunk is generated exactly once even if several
+/// threads ask for it at the same time; latecomers wait for the first thread to finish generating it.
+/// Generation itself runs outside of any lock. Chunks can be generated to a lower detail level first
+/// and upgraded later when needed. Tile writes to shared chunks are not synchronized; if
+/// several threads modify the same chunk, that is up to the caller to coordinate.
+struct chunkcache
+{
+	/// Create a cache for the world described by the given config, using the given chunk generator.
+	chunkcache(const chunkconfig& c, chunk_generator gen = chunkcache_generate);
+	~chunkcache();
+
+	chunkcache(const chunkcache&) = delete;
+	chunkcache& operator=(const chunkcache&) = delete;
+
+	/// Get the chunk at the given chunk coordinates with at least the given detail level, generating or
+	/// upgrading it if necessary. Thread-safe.
+	chunkpin pin(coords pos, int detail = DETAIL_FULL);
+
+	/// Get the chunk at the given chunk coordinates only if it is already generated, at whatever detail
+	/// level it currently has. Thread-safe.
+	chunkpin find(coords pos);
+
+	/// Pack the tile map of the chunk at the given chunk coordinates, if it is generated and nobody has it
+	/// pinned. It is unpacked again transparently by the next pin() or find(). Returns true if it was
+	/// packed. Thread-safe.
+	bool pack(coords pos);
+
+	/// Remove all chunks that nobody has pinned. Returns the number of chunks removed. Thread-safe.
+	size_t evict_unpinned();
+
+	/// Keep at most this many chunks, evicting those unpinned for the longest time first when trim() is
+	/// called. Evicted chunks are generated anew when asked for again, so tile changes made to them are
+	/// lost. Zero, the default, means no limit.
+	void set_budget(size_t chunks) { _budget.store(chunks, std::memory_order_relaxed); }
+	size_t budget() const { return _budget.load(std::memory_order_relaxed); }
+
+	/// Evict least recently used unpinned chunks until we are within budget. Returns the number of chunks
+	/// removed. Thread-safe.
+	size_t trim();
+
+	/// Number of chunks currently held.
+	size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+	/// Number of chunks evicted by trim() over the lifetime of the cache.
+	size_t evicted() const { return _evicted.load(std::memory_order_relaxed); }
+
+	/// Number of chunks generated over the lifetime of the cache.
+	size_t generated() const { return _generated.load(std::memory_order_relaxed); }
+
+	/// Number of times a chunk was upgraded to a higher detail level after its first generation.
+	size_t upgraded() const { return _upgraded.load(std::memory_order_relaxed); }
+
+	const chunkconfig& config() const { return _config; }
+
+	/// Snapshot of the packing statistics.
+	chunkcache_packing packing() const;
+
+private:
+	enum { SHARDS = 64 }; // must match the shift in shard_for()
+
+	struct shard
+	{
+		mutable std::mutex lock;
+		std::condition_variable ready;
+		std::unordered_map<coords, std::unique_ptr<chunkcache_entry>> entries;
+	};
+
+	void inflate(chunkcache_entry* e); // call with the shard lock held
+	void forget_packed(const chunk& c);
+	void erase(std::unordered_map<coords, std::unique_ptr<chunkcache_entry>>::iterator it); // with the shard lock held
+
+	shard& shard_for(coords pos) { return _shards[(std::hash<coords>()(pos) * 0x9E3779B97F4A7C15ull) >> 58]; }
+	uint64_t tick() { return _clock.fetch_add(1, std::memory_order_relaxed); }
+
+	chunkconfig _config;
+	chunk_generator _generator;
+	std::atomic<size_t> _generated{0};
+	std::atomic<size_t> _upgraded{0};
+	std::atomic<size_t> _size{0};
+	std::atomic<size_t> _budget{0};
+	std::atomic<size_t> _evicted{0};
+	std::atomic<uint64_t> _clock{0}; // orders uses of chunks for trim()
+	std::atomic<size_t> _packed{0};
+	std::atomic<size_t> _packed_raw_bytes{0};
+	std::atomic<size_t> _packed_bytes{0};
+	std::atomic<size_t> _inflations{0};
+	std::atomic<uint64_t> _inflate_ns{0};
+	shard _shards[SHARDS];
+};
@@ -0,0 +1,251 @@
+#include "chunkexport.h"
+
+#include <string.h>
+
+#include <vector>
+
+static const uint32_t record_magic = 0x524b4843; // "CHKR"
+static const size_t room_bytes = 20;
+static const size_t entity_bytes = 7;
+
+static inline void put(std::string& out, uint64_t v, int bytes)
+{
+	for (int i = 0; i < bytes; i++) out.push_back((char)(v >> (8 * i)));
+}
+
+static void put_uint(std::string& out, uint64_t v)
+{
+	char buf[20];
+	int n = 0;
+	do { buf[n++] = '0' + v % 10; v /= 10; } while (v);
+	while (n) out.push_back(buf[--n]);
+}
+
+static void put_int(std::string& out, int64_t v)
+{
+	if (v < 0) { out.push_back('-'); put_uint(out, -(uint64_t)v); }
+	else put_uint(out, v);
+}
+
+static void put_field(std::string& out, const char* name, int64_t v)
+{
+	out.push_back(',');
+	out.push_back('"');
+	out.append(name);
+	out.append("\":");
+	put_int(out, v);
+}
+
+static void append_binary(std::string& out, const chunk& c, uint64_t value)
+{
+	const size_t start = out.size();
+	const size_t tiles = c.width * c.height;
+	put(out, record_magic, 4);
+	put(out, 0, 4); // size, filled in below
+	put(out, value, 8);
+	put(out, c.config.x, 8);
+	put(out, c.config.y, 8);
+	put(out, (uint32_t)c.config.z, 4);
+	put(out, c.width, 2);
+	put(out, c.height, 2);
+	put(out, c.config.chaos, 1);
+	put(out, c.config.openness, 1);
+	put(out, (uint16_t)c.top, 2);
+	put(out, (uint16_t)c.bottom, 2);
+	put(out, (uint16_t)c.left, 2);
+	put(out, (uint16_t)c.right, 2);
+	put(out, c.rooms.size(), 4);
+	put(out, c.entities.size(), 4);
+	out.reserve(out.size() + tiles + c.rooms.size() * room_bytes + c.entities.size() * entity_bytes);
+	out.append((const char*)c.tiles(), tiles);
+	for (const room& r : c.rooms)
+	{
+		put(out, (uint16_t)r.x1, 2); put(out, (uint16_t)r.y1, 2); put(out, (uint16_t)r.x2, 2); put(out, (uint16_t)r.y2, 2);
+		put(out, (uint16_t)r.top, 2); put(out, (uint16_t)r.bottom, 2); put(out, (uint16_t)r.left, 2); put(out, (uint16_t)r.right, 2);
+		put(out, (uint8_t)r.isolation, 1); put(out, (uint8_t)r.flags, 1); put(out, (uint16_t)r.index, 2);
+	}
+	for (const entity& e : c.entities)
+	{
+		put(out, e.type, 1); put(out, (uint16_t)e.x, 2); put(out, (uint16_t)e.y, 2); put(out, (uint16_t)e.room_index, 2);
+	}
+	const uint32_t size = out.size() - start - 8;
+	for (int i = 0; i < 4; i++) out[start + 4 + i] = (char)(size >> (8 * i));
+}
+
+static void append_json(std::string& out, const chunk& c, uint64_t value)
+{
+	static const char hex[] = "0123456789abcdef";
+	out.append("{\"seed\":");
+	put_uint(out, value);
+	put_field(out, "x", c.config.x);
+	put_field(out, "y", c.config.y);
+	put_field(out, "z", c.config.z);
+	put_field(out, "width", c.width);
+	put_field(out, "height", c.height);
+	put_field(out, "chaos", c.config.chaos);
+	put_field(out, "openness", c.config.openness);
+	put_field(out, "top", c.top);
+	put_field(out, "bottom", c.bottom);
+	put_field(out, "left", c.left);
+	put_field(out, "right", c.right);
+	out.append(",\"tiles\":\"");
+	const size_t tiles = c.width * c.height;
+	const size_t pos = out.size();
+	out.resize(pos + tiles * 2);
+	const uint8_t* t = c.tiles();
+	for (size_t i = 0; i < tiles; i++)
+	{
+		out[pos + i * 2] = hex[t[i] >> 4];
+		out[pos + i * 2 + 1] = hex[t[i] & 15];
+	}
+	out.append("\",\"rooms\":[");
+	bool first = true;
+	for (const room& r : c.rooms)
+	{
+		if (!first) out.push_back(',');
+		first = false;
+		out.push_back('[');
+		const int fields[] = { r.x1, r.y1, r.x2, r.y2, r.top, r.bottom, r.left, r.right, r.isolation, r.flags, r.index };
+		for (unsigned i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) { if (i) out.push_back(','); put_int(out, fields[i]); }
+		out.push_back(']');
+	}
+	out.append("],\"entities\":[");
+	for (unsigned i = 0; i < c.entities.size(); i++)
+	{
+		const entity& e = c.entities[i];
+		if (i) out.push_back(',');
+		out.push_back('[');
+		put_int(out, e.type); out.push_back(',');
+		put_int(out, e.x); out.push_back(',');
+		put_int(out, e.y); out.push_back(',');
+		put_int(out, e.room_index);
+		out.push_back(']');
+	}
+	out.append("]}\n");
+}
+
+void chunkexport_append(std::string& out, const chunk& c, uint64_t value, int format)
+{
+	chunk_trace_scope trace("export chunk", &c);
+	if (format == EXPORT_JSONL) append_json(out, c, value);
+	else append_binary(out, c, value);
+}
+
+chunkwriter::chunkwriter(FILE* fp, size_t buffer_size) : _fp(fp), _capacity(buffer_size)
+{
+	_buffer.reserve(_capacity);
+}
+
+void chunkwriter::write(const char* data, size_t size)
+{
+	_bytes += size;
+	if (_buffer.size() + size > _capacity)
+	{
+		flush();
+		if (size >= _capacity) // too big to be worth copying
+		{
+			if (fwrite(data, 1, size, _fp) != size) _failed = true;
+			return;
+		}
+	}
+	_buffer.append(data, size);
+}
+
+bool chunkwriter::flush()
+{
+	if (!_buffer.empty())
+	{
+		if (fwrite(_buffer.data(), 1, _buffer.size(), _fp) != _buffer.size()) _failed = true;
+		_buffer.clear();
+	}
+	if (fflush(_fp) != 0) _failed = true;
+	return !_failed;
+}
+
+void chunkexport_ordered::submit(uint64_t index, std::string&& record)
+{
+	std::unique_lock<std::mutex> guard(_lock);
+	_space.wait(guard, [this, index] { return index < _next + _window; });
+	if (index != _next)
+	{
+		_pending.emplace(index, std::move(record));
+		return;
+	}
+	_out.write(record);
+	_next++;
+	for (auto it = _pending.begin(); it != _pending.end() && it->first == _next; it = _pending.erase(it))
+	{
+		_out.write(it->second);
+		_next++;
+	}
+	_space.notify_all();
+}
+
+// Reads little-endian fields from a record, remembering if we ran past its end.
+struct record_reader
+{
+	const uint8_t* p;
+	const uint8_t* end;
+	bool bad = false;
+
+	uint64_t get(int bytes)
+	{
+		if (end - p < bytes) { bad = true; return 0; }
+		uint64_t v = 0;
+		for (int i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+		p += bytes;
+		return v;
+	}
+	int s16() { return (int16_t)get(2); }
+	int s8() { return (int8_t)get(1); }
+};
+
+bool chunkexport_read(FILE* fp, chunkrecord& r)
+{
+	uint8_t header[8];
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header)) return false;
+	record_reader head = { header, header + sizeof(header) };
+	if (head.get(4) != record_magic) return false;
+	const uint32_t size = head.get(4);
+	std::vector<uint8_t> body(size);
+	if (fread(body.data(), 1, size, fp) != size) return false;
+	record_reader in = { body.data(), body.data() + size };
+	r.value = in.get(8);
+	r.x = (int64_t)in.get(8);
+	r.y = (int64_t)in.get(8);
+	r.z = (int32_t)in.get(4);
+	r.width = in.get(2);
+	r.height = in.get(2);
+	r.chaos = in.get(1);
+	r.openness = in.get(1);
+	r.top = in.s16();
+	r.bottom = in.s16();
+	r.left = in.s16();
+	r.right = in.s16();
+	const uint32_t rooms = in.get(4);
+	const uint32_t entities = in.get(4);
+	const size_t tiles = (size_t)r.width * r.height;
+	if (in.bad || (size_t)(in.end - in.p) != tiles + rooms * room_bytes + entities * entity_bytes) return false;
+	r.tiles.assign(in.p, in.p + tiles);
+	in.p += tiles;
+	r.rooms.clear();
+	for (uint32_t i = 0; i < rooms; i++)
+	{
+		const int x1 = in.s16(), y1 = in.s16(), x2 = in.s16(), y2 = in.s16();
+		room rr(x1, y1, x2, y2);
+		rr.top = in.s16(); rr.bottom = in.s16(); rr.left = in.s16(); rr.right = in.s16();
+		rr.isolation = in.s8(); rr.flags = in.s8(); rr.index = in.s16();
+		r.rooms.push_back(rr);
+	}
+	r.entities.clear();
+	for (uint32_t i = 0; i < entities; i++)
+	{
+		entity e;
+		e.type = (tile_type)in.get(1);
+		e.x = in.s16();
+		e.y = in.s16();
+		e.room_index = in.s16();
+		r.entities.push_back(e);
+	}
+	return !in.bad;
+}
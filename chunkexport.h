@@ -0,0 +1,94 @@
+// Chunkexport - stream generated chunks to files or pipes in bulk
+
+#pragma once
+
+#include "chunky.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+enum export_format
+{
+	EXPORT_BINARY, // length-prefixed little-endian records, see chunkexport_append()
+	EXPORT_JSONL, // one JSON object per line
+};
+
+/// Append one record for a chunk to 'out'. 'value' is the seed value the chunk was made from.
+///
+/// A binary record is, all little-endian: u32 magic "CHKR", u32 size of the rest of the record, u64 seed value,
+/// i64 x, i64 y, i32 z (floor), u16 width, u16 height, u8 chaos, u8 openness, i16 exits top, bottom, left and right,
+/// u32 room count, u32 entity count, then width * height tile bytes row by row, then per room i16 x1, y1, x2, y2,
+/// top, bottom, left, right, i8 isolation, i8 flags, i16 index, then per entity u8 type, i16 x, y and room index.
+///
+/// A JSON record has the same fields, with tiles as one string of two hex digits per tile, and rooms and entities
+/// as arrays of arrays in the above field order.
+void chunkexport_append(std::string& out, const chunk& c, uint64_t value, int format);
+
+/// Buffered writer to a FILE that writes in big blocks. Not thread safe.
+class chunkwriter
+{
+public:
+	/// The caller keeps ownership of 'fp'. A buffer of a few megabytes keeps pipes and disks busy.
+	chunkwriter(FILE* fp, size_t buffer_size = 4 << 20);
+	~chunkwriter() { flush(); }
+
+	void write(const char* data, size_t size);
+	void write(const std::string& s) { write(s.data(), s.size()); }
+	/// Write out what is buffered. Returns false if any write so far has failed.
+	bool flush();
+	bool ok() const { return !_failed; }
+	/// Bytes written, including those still in the buffer.
+	uint64_t bytes() const { return _bytes; }
+
+private:
+	FILE* _fp;
+	std::string _buffer;
+	size_t _capacity;
+	uint64_t _bytes = 0;
+	bool _failed = false;
+};
+
+/// Takes records numbered from zero that are made on many threads, and writes them to a chunkwriter in order.
+/// Threads that get more than 'window' records ahead of the oldest unwritten one wait, which bounds memory use.
+class chunkexport_ordered
+{
+public:
+	chunkexport_ordered(chunkwriter& out, int window = 256) : _out(out), _window(window) {}
+
+	/// Every index must be submitted exactly once.
+	void submit(uint64_t index, std::string&& record);
+	uint64_t written() const { std::lock_guard<std::mutex> guard(_lock); return _next; }
+
+private:
+	chunkwriter& _out;
+	const uint64_t _window;
+	mutable std::mutex _lock;
+	std::condition_variable _space;
+	std::map<uint64_t, std::string> _pending;
+	uint64_t _next = 0;
+};
+
+/// A chunk read back from a binary export.
+struct chunkrecord
+{
+	uint64_t value = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int z = 0;
+	int width = 0;
+	int height = 0;
+	int chaos = 0;
+	int openness = 0;
+	int top = -1;
+	int bottom = -1;
+	int left = -1;
+	int right = -1;
+	std::vector<uint8_t> tiles;
+	std::vector<room> rooms;
+	std::vector<entity> entities;
+};
+
+/// Read the next binary record from 'fp'. Returns false at the end of the stream or on a malformed record.
+bool chunkexport_read(FILE* fp, chunkrecord& r);
@@ -1,4 +1,7 @@
 #include "chunky.h"
+#include "chunkexport.h"
+#include "chunkrender.h"
+#include "chunksearch.h"
 
 #include <assert.h>
 #include <string.h>
@@ -7,6 +10,9 @@
 #include <time.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <vector>
 #include <string>
 
@@ -18,12 +24,26 @@ static int level_width = 4;
 static int level_height = 4;
 static int xpos = 1;
 static int ypos = 1;
+static std::string trace_file;
+static int count = -1; // not given
+static int threads = std::max(1u, std::thread::hardware_concurrency());
+static bool validate = false;
+static int find = 0;
+static int min_boss_size = 0;
+static int min_chest_isolation = 0;
+static int min_one_way_doors = 0;
+static int layout = -1;
+static std::string export_file;
+static int export_format = EXPORT_BINARY;
+static std::string image_file;
+static int image_format = RENDER_PPM;
+static int scale = 1;
 
 static void usage()
 {
 	printf("chunkgen command line options\n");
 	printf("-h/--help              This help\n");
-	printf("-d/--debug L           Set debug level [0,1,2,3]\n");
+	printf("-d/--debug L           Set debug level [0,1,2,3]; 1+ prints statistics if built with CHUNKY_STATS\n");
 	printf("-s/--seed S            Set random seed value\n");
 	printf("-W/--width M           Width of chunk (default %d, must be power-of-two)\n", width);
 	printf("-H/--height H          Height of chunk (default %d, must be power-of-two)\n", height);
@@ -32,6 +52,19 @@ static void usage()
 	printf("-x/--level-x-pos X     Level X position of chunk (default %d)\n", xpos);
 	printf("-y/--level-y-pos Y     Level Y position of chunks (default %d)\n", ypos);
 	printf("-m/--method M          Initial layout [main (default), inner, grand]\n");
+	printf("-t/--trace FILE        Write a Chrome trace of the generation steps to FILE\n");
+	printf("-n/--count N           Generate N chunks from seeds S to S+N-1 and report timings instead of printing\n");
+	printf("-j/--threads T         Number of threads to use with --count (default %d)\n", threads);
+	printf("-V/--validate          Run self tests on every chunk with --count (needs a debug build)\n");
+	printf("-e/--export FILE       Write the --count chunks to FILE ('-' for stdout) instead of printing\n");
+	printf("-F/--format F          Export format [bin (default), jsonl] or level image format [ppm (default), pgm]\n");
+	printf("-L/--level-image FILE  Generate the whole level from seed S and write it as one image to FILE ('-' for stdout)\n");
+	printf("--scale N              Pixels per tile side in the level image (default %d)\n", scale);
+	printf("-f/--find K            Search seeds from S onward for K chunks matching the criteria below; tries --count seeds (default 1000000)\n");
+	printf("--layout L             Find: skeleton made by exit connector L [main, inner, grand]\n");
+	printf("--min-boss-size N      Find: boss room has at least N tiles\n");
+	printf("--min-chest-isolation N  Find: chest room has isolation at least N\n");
+	printf("--min-one-way-doors N  Find: at least N one-way doors\n");
 	exit(-1);
 }
 
@@ -65,12 +98,27 @@ static std::string get_str(const char* in, int& remaining)
 	return in;
 }
 
-static void stress_test(chunkconfig& config, int method)
+static chunkconfig make_config(uint64_t value)
 {
-	seed s = config.state;
-	chunk c(config);
+	seed s(value, value);
+	chunkconfig config(s);
+	config.width = width;
+	config.height = height;
+	config.level_width = level_width;
+	config.level_height = level_height;
+	config.x = xpos;
+	config.y = ypos;
+	config.chaos = s.roll(0, 4);
+	config.openness = s.roll(0, 4);
+	return config;
+}
+
+// Returns the index of the boss room.
+static int stress_test(chunk& c, int method, bool validate)
+{
+	seed s = c.config.state;
 	c.generate_exits();
-	c.self_test();
+	if (validate) c.self_test();
 	bool success = true;
 	switch (method)
 	{
@@ -87,16 +135,139 @@ static void stress_test(chunkconfig& config, int method)
 
 	const int iter = s.roll(2, 8);
 	chunk_filter_room_expand(c, iter, iter + 6);
-	c.self_test();
+	if (validate) c.self_test();
 	chunk_filter_room_in_room(c);
-	c.self_test();
+	if (validate) c.self_test();
 	chunk_filter_one_way_doors(c, s.roll(0, 4));
 	c.beautify();
-	room r = chunk_filter_boss_placement(c, 0);
+	room& r = chunk_filter_boss_placement(c, 0);
 	chunk_filter_protect_room(c, r);
 	chunk_filter_wildlife(c);
 	chunk_filter_chest(c);
-	print_room(c, r.index);
+	return r.index;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, int p)
+{
+	return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+static void run_many(uint64_t first, int method)
+{
+	std::vector<uint64_t> latency(count);
+	std::atomic<int> next(0);
+	std::vector<std::thread> pool;
+	const auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++)
+	{
+		pool.emplace_back([&latency, &next, first, method]
+		{
+			for (int i = next++; i < count; i = next++)
+			{
+				const auto t0 = std::chrono::steady_clock::now();
+				chunk c(make_config(first + i));
+				stress_test(c, method, validate);
+				latency[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+			}
+		});
+	}
+	for (std::thread& t : pool) t.join();
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<uint64_t> sorted = latency;
+	std::sort(sorted.begin(), sorted.end());
+	printf("Generated %d chunks of %dx%d on %d threads in %.3f s: %.1f chunks/s\n", count, width, height, threads, secs, count / secs);
+	printf("Latency us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", percentile(sorted, 50) / 1000.0, percentile(sorted, 90) / 1000.0,
+	       percentile(sorted, 99) / 1000.0, sorted.back() / 1000.0);
+	std::vector<int> order(count);
+	for (int i = 0; i < count; i++) order[i] = i;
+	const int slowest = std::min(count, 5);
+	std::partial_sort(order.begin(), order.begin() + slowest, order.end(), [&latency](int a, int b) { return latency[a] > latency[b]; });
+	printf("Slowest seeds:");
+	for (int i = 0; i < slowest; i++) printf(" %llu (%.1f us)", (unsigned long long)(first + order[i]), latency[order[i]] / 1000.0);
+	printf("\n");
+}
+
+static void run_export(uint64_t first, int method)
+{
+	FILE* fp = (export_file == "-") ? stdout : fopen(export_file.c_str(), "wb");
+	if (!fp)
+	{
+		printf("Could not open %s!\n", export_file.c_str());
+		exit(-1);
+	}
+	chunkwriter out(fp);
+	chunkexport_ordered ordered(out, threads * 64);
+	std::atomic<int> next(0);
+	std::vector<std::thread> pool;
+	const auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++)
+	{
+		pool.emplace_back([&ordered, &next, first, method]
+		{
+			for (int i = next++; i < count; i = next++)
+			{
+				chunk c(make_config(first + i));
+				stress_test(c, method, validate);
+				std::string record;
+				chunkexport_append(record, c, first + i, export_format);
+				ordered.submit(i, std::move(record));
+			}
+		});
+	}
+	for (std::thread& t : pool) t.join();
+	bool ok = out.flush();
+	if (fp != stdout) ok = (fclose(fp) == 0) && ok;
+	if (!ok)
+	{
+		fprintf(stderr, "Failed writing to %s!\n", export_file.c_str());
+		exit(-1);
+	}
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "Exported %d chunks of %dx%d on %d threads in %.3f s: %.1f chunks/s, %.1f MB/s\n", count, width, height, threads, secs,
+	        count / secs, out.bytes() / secs / 1000000.0);
+}
+
+static void run_level_image(uint64_t value, int method)
+{
+	FILE* fp = (image_file == "-") ? stdout : fopen(image_file.c_str(), "wb");
+	if (!fp)
+	{
+		printf("Could not open %s!\n", image_file.c_str());
+		exit(-1);
+	}
+	const auto start = std::chrono::steady_clock::now();
+	bool ok = chunk_render_level(fp, make_config(value), [method](chunk& c) { stress_test(c, method, validate); }, image_format, scale, threads);
+	if (fp != stdout) ok = (fclose(fp) == 0) && ok;
+	if (!ok)
+	{
+		fprintf(stderr, "Failed writing to %s!\n", image_file.c_str());
+		exit(-1);
+	}
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const double tiles = (double)level_width * width * level_height * height;
+	fprintf(stderr, "Rendered %dx%d chunks of %dx%d on %d threads in %.3f s: %.1f million tiles/s\n", level_width, level_height, width, height,
+	        threads, secs, tiles / secs / 1000000.0);
+}
+
+static void run_search(uint64_t first, int method)
+{
+	std::vector<search_predicate> predicates;
+	if (layout >= 0) predicates.push_back({ SEARCH_SKELETON, [](const chunk& c) { return chunk_skeleton_layout(c) == layout; } });
+	if (min_one_way_doors > 0) predicates.push_back({ SEARCH_ROOMS, [](const chunk& c) { return chunk_one_way_door_count(c) >= min_one_way_doors; } });
+	if (min_boss_size > 0) predicates.push_back({ SEARCH_POPULATED, [](const chunk& c) { const room* r = chunk_boss_room(c); return r && r->size() >= min_boss_size; } });
+	if (min_chest_isolation > 0) predicates.push_back({ SEARCH_POPULATED, [](const chunk& c) { const room* r = chunk_chest_room(c); return r && r->isolation >= min_chest_isolation; } });
+	search_options options;
+	options.first = first;
+	options.count = count;
+	options.threads = threads;
+	options.max_matches = find;
+	const search_result result = seed_search(make_config, search_pipeline_chunkgen(method), predicates, options);
+	printf("Found %d of %d wanted in %llu seeds on %d threads in %.3f s: %.1f seeds/s\n", (int)result.matches.size(), find,
+	       (unsigned long long)result.evaluated, threads, result.seconds, result.evaluated / result.seconds);
+	printf("Rejected after skeleton %llu, rooms %llu, population %llu\n", (unsigned long long)result.rejected[SEARCH_SKELETON],
+	       (unsigned long long)result.rejected[SEARCH_ROOMS], (unsigned long long)result.rejected[SEARCH_POPULATED]);
+	for (uint64_t value : result.matches) printf("%llu\n", (unsigned long long)value);
 }
 
 int main(int argc, char **argv)
@@ -150,27 +321,110 @@ int main(int argc, char **argv)
 			else if (v == "grand") method = 2;
 			else usage();
 		}
+		else if (match(argv[i], "-t", "--trace", remaining))
+		{
+			trace_file = get_str(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-n", "--count", remaining))
+		{
+			count = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-j", "--threads", remaining))
+		{
+			threads = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-V", "--validate", remaining))
+		{
+			validate = true;
+		}
+		else if (match(argv[i], "-e", "--export", remaining))
+		{
+			export_file = get_str(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-F", "--format", remaining))
+		{
+			std::string v = get_str(argv[++i], remaining);
+			if (v == "bin") export_format = EXPORT_BINARY;
+			else if (v == "jsonl") export_format = EXPORT_JSONL;
+			else if (v == "ppm") image_format = RENDER_PPM;
+			else if (v == "pgm") image_format = RENDER_PGM;
+			else usage();
+		}
+		else if (match(argv[i], "-L", "--level-image", remaining))
+		{
+			image_file = get_str(argv[++i], remaining);
+		}
+		else if (match(argv[i], "--scale", "--scale", remaining))
+		{
+			scale = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "-f", "--find", remaining))
+		{
+			find = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "--layout", "--layout", remaining))
+		{
+			std::string v = get_str(argv[++i], remaining);
+			if (v == "main") layout = 0;
+			else if (v == "inner") layout = 1;
+			else if (v == "grand") layout = 2;
+			else usage();
+		}
+		else if (match(argv[i], "--min-boss-size", "--min-boss-size", remaining))
+		{
+			min_boss_size = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "--min-chest-isolation", "--min-chest-isolation", remaining))
+		{
+			min_chest_isolation = get_int(argv[++i], remaining);
+		}
+		else if (match(argv[i], "--min-one-way-doors", "--min-one-way-doors", remaining))
+		{
+			min_one_way_doors = get_int(argv[++i], remaining);
+		}
 	}
-	if (remaining > 0) usage();
+	if (count == -1) count = (find > 0) ? 1000000 : 1;
+	if (remaining > 0 || count < 1 || threads < 1 || find < 0 || scale < 1) usage();
 	if (xpos >= level_width || ypos >= level_height)
 	{
 		printf("Level position must be within level width and height!\n");
 		exit(-1);
 	}
-	printf("Showing room from seed %llu:\n", (unsigned long long)value);
-
-	seed s(value, value);
-	chunkconfig config(s);
-	config.width = width;
-	config.height = height;
-	config.level_width = level_width;
-	config.level_height = level_height;
-	config.x = xpos;
-	config.y = ypos;
-	config.chaos = s.roll(0, 4);
-	config.openness = s.roll(0, 4);
-
-	stress_test(config, method);
+#ifdef NDEBUG
+	if (validate) printf("Warning: self tests are compiled out in release builds, --validate does nothing!\n");
+#endif
+	if (!trace_file.empty()) chunk_trace_start();
+	if (!image_file.empty())
+	{
+		run_level_image(value, method);
+	}
+	else if (!export_file.empty())
+	{
+		run_export(value, method);
+	}
+	else if (find > 0)
+	{
+		run_search(value, method);
+	}
+	else if (count > 1)
+	{
+		run_many(value, method);
+	}
+	else
+	{
+		printf("Showing room from seed %llu:\n", (unsigned long long)value);
+		chunk c(make_config(value));
+		const int boss = stress_test(c, method, true);
+		print_room(c, boss);
+#ifdef CHUNKY_STATS
+		if (p__debug_level > 0) c.stats.print();
+#endif
+	}
+	if (!trace_file.empty() && !chunk_trace_write(trace_file.c_str()))
+	{
+		printf("Could not write trace to %s!\n", trace_file.c_str());
+		exit(-1);
+	}
 
 	return 0;
 }
@@ -0,0 +1,190 @@
+#include "chunkgraph.h"
+
+#include <algorithm>
+
+static inline bool passable(uint8_t t)
+{
+	return t != TILE_ROCK && t != TILE_WALL && t != TILE_WALL_DAMAGED;
+}
+
+static inline bool door_like(uint8_t t)
+{
+	const int f = tile_feature(t);
+	return f == FEATURE_DOOR || f == FEATURE_ONE_WAY;
+}
+
+// Room reached through the exit at (x, y), looking a few tiles inwards in case the exit itself belongs to no room
+static int exit_room(const chunk& c, const std::vector<int16_t>& owner, int x, int y, int dx, int dy)
+{
+	for (int i = 0; i < 3 && x >= 0 && y >= 0 && x < c.width && y < c.height && passable(c.at(x, y)); i++, x += dx, y += dy)
+	{
+		if (owner[y * c.width + x] != -1) return owner[y * c.width + x];
+	}
+	return -1;
+}
+
+chunk_links chunk_room_links(const chunk& c)
+{
+	CHUNK_ASSERT(c, !c.packed());
+	chunk_links result;
+	result.rooms = (int)c.rooms.size();
+	const int w = c.width;
+	const int h = c.height;
+
+	// Nested rooms are smaller than the rooms around them, so painting from large to small leaves each tile with the
+	// innermost room covering it
+	std::vector<const room*> order;
+	for (const room& r : c.rooms) order.push_back(&r);
+	std::stable_sort(order.begin(), order.end(), [](const room* a, const room* b) { return a->size() > b->size(); });
+	std::vector<int16_t> owner(w * h, -1);
+	for (const room* r : order)
+	{
+		for (int y = r->y1; y <= r->y2; y++) for (int x = r->x1; x <= r->x2; x++) owner[y * w + x] = r->index;
+	}
+
+	auto link = [&result](int a, int b) { if (a != b) result.edges.emplace_back(a, b); };
+	auto one_way = [](uint8_t t) { return tile_feature(t) == FEATURE_ONE_WAY; };
+	auto connector = [&](int x, int y) { const uint8_t t = c.at(x, y); return passable(t) && !one_way(t) && (owner[y * w + x] == -1 || door_like(t)); };
+
+	// Rooms whose tiles touch
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			const int o = owner[y * w + x];
+			if (o == -1 || !passable(c.at(x, y)) || door_like(c.at(x, y))) continue;
+			if (x + 1 < w && owner[y * w + x + 1] != -1 && passable(c.at(x + 1, y)) && !door_like(c.at(x + 1, y))) { link(o, owner[y * w + x + 1]); link(owner[y * w + x + 1], o); }
+			if (y + 1 < h && owner[(y + 1) * w + x] != -1 && passable(c.at(x, y + 1)) && !door_like(c.at(x, y + 1))) { link(o, owner[(y + 1) * w + x]); link(owner[(y + 1) * w + x], o); }
+		}
+	}
+
+	// Doors and open tiles outside of rooms form groups that join all the rooms around them
+	static const int dx[4] = { 0, 0, -1, 1 };
+	static const int dy[4] = { -1, 1, 0, 0 };
+	std::vector<int> group(w * h, -1);
+	std::vector<std::vector<int>> group_rooms;
+	std::vector<int> todo;
+	for (int i = 0; i < w * h; i++)
+	{
+		if (group[i] != -1 || !connector(i % w, i / w)) continue;
+		const int g = (int)group_rooms.size();
+		group_rooms.emplace_back();
+		std::vector<int>& around = group_rooms.back();
+		group[i] = g;
+		todo.push_back(i);
+		while (!todo.empty())
+		{
+			const int j = todo.back();
+			todo.pop_back();
+			for (int d = 0; d < 4; d++)
+			{
+				const int x = j % w + dx[d];
+				const int y = j / w + dy[d];
+				if (x < 0 || y < 0 || x >= w || y >= h) continue;
+				const int k = y * w + x;
+				if (connector(x, y)) { if (group[k] == -1) { group[k] = g; todo.push_back(k); } }
+				else if (owner[k] != -1 && passable(c.at(x, y)) && !one_way(c.at(x, y))) around.push_back(owner[k]);
+			}
+		}
+		std::sort(around.begin(), around.end());
+		around.erase(std::unique(around.begin(), around.end()), around.end());
+		for (int a : around) for (int b : around) link(a, b);
+	}
+
+	// One-way doors join the rooms on one side to those on the other, in one direction only
+	std::vector<int> from;
+	std::vector<int> to;
+	auto side = [&](int x, int y, std::vector<int>& out)
+	{
+		out.clear();
+		if (x < 0 || y < 0 || x >= w || y >= h || !passable(c.at(x, y)) || one_way(c.at(x, y))) return;
+		if (group[y * w + x] != -1) out = group_rooms[group[y * w + x]];
+		else if (owner[y * w + x] != -1) out.push_back(owner[y * w + x]);
+	};
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			const uint8_t t = c.at(x, y);
+			if (!one_way(t)) continue;
+			const int d = t - TILE_ONE_WAY_TOP; // same order as dx and dy
+			side(x - dx[d], y - dy[d], from);
+			side(x + dx[d], y + dy[d], to);
+			for (int a : from) for (int b : to) link(a, b);
+		}
+	}
+	std::sort(result.edges.begin(), result.edges.end());
+	result.edges.erase(std::unique(result.edges.begin(), result.edges.end()), result.edges.end());
+
+	if (c.top != -1) result.top = exit_room(c, owner, c.top, 0, 0, 1);
+	if (c.bottom != -1) result.bottom = exit_room(c, owner, c.bottom, h - 1, 0, -1);
+	if (c.left != -1) result.left = exit_room(c, owner, 0, c.left, 1, 0);
+	if (c.right != -1) result.right = exit_room(c, owner, w - 1, c.right, -1, 0);
+	return result;
+}
+
+void roomgraph::update(const chunkview& v)
+{
+	// Drop chunks the view let go of, and scan the ones it got since last time
+	std::unordered_map<coords, cached> current;
+	scanned = 0;
+	v.for_each_chunk([&](coords cc, const chunk& c, int detail)
+	{
+		auto it = _chunks.find(cc);
+		if (it != _chunks.end() && it->second.revision == c.revision && it->second.detail == detail)
+		{
+			current.emplace(cc, std::move(it->second));
+			return;
+		}
+		current.emplace(cc, cached{ c.revision, detail, chunk_room_links(c) });
+		scanned++;
+	});
+	_chunks.swap(current);
+
+	// Number the rooms chunk by chunk, in a fixed order so that node ids do not depend on hashing
+	std::vector<coords> order;
+	order.reserve(_chunks.size());
+	for (const auto& it : _chunks) order.push_back(it.first);
+	std::sort(order.begin(), order.end());
+	_first.clear();
+	nodes.clear();
+	for (const coords& cc : order)
+	{
+		_first[cc] = (uint32_t)nodes.size();
+		for (int i = 0; i < _chunks.at(cc).links.rooms; i++) nodes.push_back({ cc, i });
+	}
+
+	// Edges inside chunks, then both ways across each exit whose neighbour we also have
+	std::vector<std::pair<uint32_t, uint32_t>> edges;
+	for (const coords& cc : order)
+	{
+		const chunk_links& l = _chunks.at(cc).links;
+		const uint32_t base = _first.at(cc);
+		for (const auto& e : l.edges) edges.emplace_back(base + e.first, base + e.second);
+		auto across = [&](int from, int64_t nx, int64_t ny, int chunk_links::*side)
+		{
+			auto it = _chunks.find({ nx, ny, cc.z });
+			if (from == -1 || it == _chunks.end() || it->second.links.*side == -1) return;
+			const uint32_t to = _first.at(it->first) + it->second.links.*side;
+			edges.emplace_back(base + from, to);
+			edges.emplace_back(to, base + from);
+		};
+		across(l.right, cc.x + 1, cc.y, &chunk_links::left); // each seam once, from its left or top side
+		across(l.bottom, cc.x, cc.y + 1, &chunk_links::top);
+	}
+
+	// Counting sort into compressed sparse rows
+	offsets.assign(nodes.size() + 1, 0);
+	for (const auto& e : edges) offsets[e.first + 1]++;
+	for (size_t i = 0; i < nodes.size(); i++) offsets[i + 1] += offsets[i];
+	targets.resize(edges.size());
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (const auto& e : edges) targets[fill[e.first]++] = e.second;
+}
+
+int roomgraph::node(coords chunk, int room_index) const
+{
+	auto it = _first.find(chunk);
+	if (it == _first.end() || room_index < 0 || room_index >= _chunks.at(chunk).links.rooms) return -1;
+	return (int)(it->second + room_index);
+}
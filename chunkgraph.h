@@ -0,0 +1,67 @@
+// Chunkgraph - room connectivity graphs of chunks and of the region a chunkview holds
+
+#pragma once
+
+#include "chunky.h"
+#include "chunkview.h"
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// How the rooms of one chunk connect, found from its tiles. Rooms are indices into the chunk's room list.
+struct chunk_links
+{
+	int rooms = 0; // size of the room list
+	std::vector<std::pair<int, int>> edges; // directed, sorted and unique; doors that work both ways give both directions
+	int top = -1; // room reached through each exit, or -1 if the chunk has no exit there
+	int bottom = -1;
+	int left = -1;
+	int right = -1;
+};
+
+/// Find how the rooms of a chunk connect, in one pass over its tiles. Each tile is given to the innermost room covering
+/// it. Rooms whose tiles touch are connected both ways. So are all rooms around a group of doors and open tiles that
+/// belong to no room. One-way doors only connect in the direction they can be passed.
+chunk_links chunk_room_links(const chunk& c);
+
+/// A room of a roomgraph: which chunk, and where in its room list.
+struct roomgraph_node
+{
+	coords chunk;
+	int room_index;
+};
+
+/// Room connectivity graph of the chunks a chunkview holds on its current floor, in compressed sparse row form.
+/// It includes edges between rooms of neighbouring chunks that meet at their shared exits.
+struct roomgraph
+{
+	/// Bring the graph up to date with the view. Only chunks that are new, or were upgraded since the last update,
+	/// are scanned; the rest reuse their links. The CSR arrays are then rebuilt in time linear in rooms and edges.
+	/// Tile changes made to a chunk after it was scanned are not seen.
+	void update(const chunkview& v);
+
+	/// Node id of a room, or -1 if its chunk is not in the graph.
+	int node(coords chunk, int room_index) const;
+	int node_count() const { return (int)nodes.size(); }
+	int edge_count() const { return (int)targets.size(); }
+	/// Rooms reachable in one step from a node are targets[offsets[node]] up to targets[offsets[node + 1]].
+	const uint32_t* begin(int n) const { return targets.data() + offsets[n]; }
+	const uint32_t* end(int n) const { return targets.data() + offsets[n + 1]; }
+
+	std::vector<roomgraph_node> nodes; // grouped by chunk, in room list order
+	std::vector<uint32_t> offsets; // node_count() + 1 entries
+	std::vector<uint32_t> targets;
+
+	int scanned = 0; // chunks scanned by the last update
+
+private:
+	struct cached
+	{
+		uint64_t revision; // chunk::revision when we scanned it
+		int detail;
+		chunk_links links;
+	};
+	std::unordered_map<coords, cached> _chunks;
+	std::unordered_map<coords, uint32_t> _first; // node id of room zero of each chunk
+};
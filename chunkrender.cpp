@@ -0,0 +1,244 @@
+#include "chunkrender.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum
+{
+	COLOUR_NONE,
+	COLOUR_DCYAN,
+	COLOUR_DYELLOW,
+	COLOUR_DBLUE,
+	COLOUR_DGREEN,
+	COLOUR_LGRAY,
+	COLOUR_LRED,
+	COLOUR_LGREEN,
+	COLOUR_LYELLOW,
+	COLOUR_LBLUE,
+	COLOUR_LCYAN,
+	COLOUR_COUNT
+};
+
+static const char* colour_codes[COLOUR_COUNT] = { "\x1b[0m", "\x1b[0;36m", "\x1b[0;33m", "\x1b[0;34m", "\x1b[0;32m", "\x1b[0;90m", "\x1b[0;91m",
+                                                  "\x1b[0;92m", "\x1b[0;93m", "\x1b[0;94m", "\x1b[0;96m" };
+static const uint8_t colour_rgb[COLOUR_COUNT][3] = { { 192, 192, 192 }, { 0, 160, 160 }, { 160, 160, 0 }, { 0, 0, 160 }, { 0, 160, 0 }, { 112, 112, 112 },
+                                                     { 255, 80, 80 }, { 80, 255, 80 }, { 255, 255, 80 }, { 80, 80, 255 }, { 80, 255, 255 } };
+
+static const int max_code = 8; // longest colour code
+
+struct tile_look
+{
+	uint8_t colour;
+	const char* glyph; // may be more than one byte in UTF-8
+	char ascii;
+};
+
+static const tile_look looks[] =
+{
+	{ COLOUR_NONE, " ", ' ' }, // TILE_ROCK
+	{ COLOUR_NONE, ".", '.' }, // TILE_EMPTY
+	{ COLOUR_DCYAN, "'", '\'' }, // TILE_DOOR_OPEN
+	{ COLOUR_DCYAN, "+", '+' }, // TILE_DOOR_CLOSED
+	{ COLOUR_DCYAN, "^", '^' }, // TILE_ONE_WAY_TOP
+	{ COLOUR_DCYAN, "_", '_' }, // TILE_ONE_WAY_BOTTOM
+	{ COLOUR_DCYAN, "[", '[' }, // TILE_ONE_WAY_LEFT
+	{ COLOUR_DCYAN, "]", ']' }, // TILE_ONE_WAY_RIGHT
+	{ COLOUR_NONE, "#", '#' }, // TILE_WALL
+	{ COLOUR_LGRAY, "#", '#' }, // TILE_WALL_DAMAGED
+	{ COLOUR_LGRAY, "*", '*' }, // TILE_DEBRIS
+	{ COLOUR_DBLUE, ".", '.' }, // TILE_RAIL
+	{ COLOUR_LRED, "§", '$' }, // TILE_SENTINEL
+	{ COLOUR_LRED, "¤", 'o' }, // TILE_TURRET
+	{ COLOUR_LRED, "I", 'I' }, // TILE_TOTEM
+	{ COLOUR_LRED, "~", '~' }, // TILE_TRAP
+	{ COLOUR_LBLUE, "A", 'A' }, // TILE_ALTAR
+	{ COLOUR_LBLUE, "S", 'S' }, // TILE_SHRINE
+	{ COLOUR_LBLUE, "G", 'G' }, // TILE_HIDDEN_GROVE
+	{ COLOUR_DGREEN, "t", 't' }, // TILE_SHRUB
+	{ COLOUR_LYELLOW, "&", '&' }, // TILE_CHEST
+	{ COLOUR_LRED, "B", 'B' }, // ENTITY_BOSS
+	{ COLOUR_LRED, "L", 'L' }, // ENTITY_LEADER
+	{ COLOUR_LGREEN, "s", 's' }, // ENTITY_SUPPORT
+	{ COLOUR_LBLUE, "T", 'T' }, // ENTITY_TANK
+	{ COLOUR_NONE, "d", 'd' }, // ENTITY_DAMAGE
+	{ COLOUR_LCYAN, "S", 'S' }, // ENTITY_SPECIALIST
+	{ COLOUR_DYELLOW, "w", 'w' }, // ENTITY_WILD
+	{ COLOUR_LYELLOW, "<", '<' }, // TILE_STAIRS_UP
+	{ COLOUR_LYELLOW, ">", '>' }, // TILE_STAIRS_DOWN
+};
+static_assert(sizeof(looks) / sizeof(looks[0]) == TILE_TYPES, "a tile type is missing from the render table");
+
+static inline const tile_look& look(uint8_t t, int x, int y, const room* highlight, int& colour)
+{
+	assert(t < TILE_TYPES);
+	colour = looks[t].colour;
+	if (highlight && t == TILE_EMPTY && highlight->is_inside(x, y)) colour = COLOUR_DYELLOW;
+	return looks[t];
+}
+
+void chunk_render_row(std::string& out, const chunk& c, int y, int format, const room* highlight)
+{
+	const uint8_t* row = c.tiles() + y * c.width;
+	if (format == RENDER_ASCII)
+	{
+		for (int x = 0; x < c.width; x++) out.push_back(looks[row[x]].ascii);
+		return;
+	}
+	// Worst case per tile is a colour code and a two byte glyph, plus a reset at the end
+	const size_t start = out.size();
+	out.resize(start + c.width * (max_code + 2) + max_code);
+	char* p = &out[start];
+	int current = COLOUR_NONE;
+	for (int x = 0; x < c.width; x++)
+	{
+		int colour;
+		const tile_look& l = look(row[x], x, y, highlight, colour);
+		if (colour != current)
+		{
+			for (const char* code = colour_codes[colour]; *code; code++) *p++ = *code;
+			current = colour;
+		}
+		for (const char* g = l.glyph; *g; g++) *p++ = *g;
+	}
+	if (current != COLOUR_NONE) for (const char* code = colour_codes[COLOUR_NONE]; *code; code++) *p++ = *code;
+	out.resize(p - out.data());
+}
+
+static inline uint8_t grey(const uint8_t rgb[3])
+{
+	return (rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29) >> 8;
+}
+
+void chunk_render_rgb(uint8_t t, uint8_t rgb[3])
+{
+	assert(t < TILE_TYPES);
+	static const uint8_t rock[3] = { 0, 0, 0 };
+	static const uint8_t floor[3] = { 64, 64, 64 };
+	const uint8_t* src = (t == TILE_ROCK) ? rock : (t == TILE_EMPTY) ? floor : colour_rgb[looks[t].colour];
+	rgb[0] = src[0];
+	rgb[1] = src[1];
+	rgb[2] = src[2];
+}
+
+void chunk_render(std::string& out, const chunk& c, int format, const room* highlight)
+{
+	if (format == RENDER_PPM || format == RENDER_PGM)
+	{
+		const bool colour = (format == RENDER_PPM);
+		char header[64];
+		const int len = snprintf(header, sizeof(header), "%s\n%d %d\n255\n", colour ? "P6" : "P5", c.width, c.height);
+		out.append(header, len);
+		const size_t pos = out.size();
+		const size_t tiles = c.width * c.height;
+		out.resize(pos + tiles * (colour ? 3 : 1));
+		char* p = &out[pos];
+		const uint8_t* tile = c.tiles();
+		for (int y = 0; y < c.height; y++)
+		{
+			for (int x = 0; x < c.width; x++)
+			{
+				uint8_t rgb[3];
+				const uint8_t t = *tile++;
+				if (highlight && t == TILE_EMPTY && highlight->is_inside(x, y)) memcpy(rgb, colour_rgb[COLOUR_DYELLOW], 3);
+				else chunk_render_rgb(t, rgb);
+				if (colour) { *p++ = rgb[0]; *p++ = rgb[1]; *p++ = rgb[2]; }
+				else *p++ = grey(rgb);
+			}
+		}
+		return;
+	}
+	out.reserve(out.size() + (c.width + 16) * c.height * (format == RENDER_ANSI ? 3 : 1));
+	for (int y = 0; y < c.height; y++)
+	{
+		chunk_render_row(out, c, y, format, highlight);
+		out.push_back('\n');
+	}
+}
+
+bool chunk_render_level(FILE* fp, const chunkconfig& config, const std::function<void(chunk& c)>& generate, int format, int scale, int threads)
+{
+	chunk_trace_scope trace("render level");
+	assert(format == RENDER_PPM || format == RENDER_PGM);
+	assert(scale > 0);
+	const int channels = (format == RENDER_PPM) ? 3 : 1;
+	const int chunk_width = config.width;
+	const int chunk_height = config.height;
+	const size_t row_bytes = (size_t)config.level_width * chunk_width * scale * channels;
+	const size_t band_bytes = row_bytes * chunk_height * scale;
+	const uint64_t total = (uint64_t)config.level_width * config.level_height;
+	if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+	// Two bands of chunks in flight: one being written out while the next is generated
+	const int slots = 2;
+	std::vector<std::vector<uint8_t>> bands(slots, std::vector<uint8_t>(band_bytes));
+	std::vector<int> done(slots, 0); // chunks finished in each band
+	int written = 0; // bands written out
+	std::mutex lock;
+	std::condition_variable changed;
+	std::atomic<uint64_t> next(0);
+
+	std::vector<std::thread> pool;
+	for (int t = 0; t < threads; t++)
+	{
+		pool.emplace_back([&]
+		{
+			for (uint64_t i = next++; i < total; i = next++)
+			{
+				const int band = i / config.level_width;
+				const int slot = band % slots;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					changed.wait(guard, [&] { return band < written + slots; });
+				}
+				chunkconfig cc = config;
+				cc.x = i % config.level_width;
+				cc.y = band;
+				chunk c(cc);
+				generate(c);
+				chunk_trace_scope raster("rasterize chunk", &c);
+				const uint8_t* tile = c.tiles();
+				for (int y = 0; y < chunk_height; y++)
+				{
+					uint8_t* line = bands[slot].data() + (size_t)y * scale * row_bytes + (size_t)cc.x * chunk_width * scale * channels;
+					uint8_t* p = line;
+					for (int x = 0; x < chunk_width; x++)
+					{
+						uint8_t rgb[3];
+						chunk_render_rgb(*tile++, rgb);
+						if (channels == 1) rgb[0] = grey(rgb);
+						for (int s = 0; s < scale; s++) for (int ch = 0; ch < channels; ch++) *p++ = rgb[ch];
+					}
+					for (int s = 1; s < scale; s++) memcpy(line + s * row_bytes, line, p - line);
+				}
+				std::lock_guard<std::mutex> guard(lock);
+				if (++done[slot] == config.level_width) changed.notify_all();
+			}
+		});
+	}
+
+	bool ok = fprintf(fp, "%s\n%llu %llu\n255\n", channels == 3 ? "P6" : "P5", (unsigned long long)config.level_width * chunk_width * scale,
+	                  (unsigned long long)config.level_height * chunk_height * scale) > 0;
+	for (int band = 0; band < config.level_height; band++)
+	{
+		const int slot = band % slots;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [&] { return done[slot] == config.level_width; });
+		}
+		{
+			chunk_trace_scope write("write band");
+			ok = (fwrite(bands[slot].data(), 1, band_bytes, fp) == band_bytes) && ok;
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		done[slot] = 0;
+		written++;
+		changed.notify_all();
+	}
+	for (std::thread& t : pool) t.join();
+	return (fflush(fp) == 0) && ok;
+}
@@ -0,0 +1,33 @@
+// Chunkrender - draw chunks into memory buffers, as terminal text or images
+
+#pragma once
+
+#include "chunky.h"
+
+#include <functional>
+#include <string>
+
+enum render_format
+{
+	RENDER_ANSI, // coloured text for terminals
+	RENDER_ASCII, // plain text for logs and diffs
+	RENDER_PPM, // binary colour image, one pixel per tile
+	RENDER_PGM, // binary greyscale image, one pixel per tile
+};
+
+/// Append a picture of a chunk to 'out'. Text formats end each row with a newline. If 'highlight' is given, its
+/// floor is drawn in yellow like print_room() does.
+void chunk_render(std::string& out, const chunk& c, int format, const room* highlight = nullptr);
+
+/// Append one row of a chunk as text, without a newline. Colours are only switched where they change, and are
+/// reset at the end of the row.
+void chunk_render_row(std::string& out, const chunk& c, int y, int format, const room* highlight = nullptr);
+
+/// Colour of a tile in images.
+void chunk_render_rgb(uint8_t t, uint8_t rgb[3]);
+
+/// Generate every chunk of a level on 'threads' threads (zero for one per core) and write the level to 'fp' as one
+/// PPM or PGM image, each tile a 'scale' x 'scale' block. 'config' gives the level; its x and y are ignored. The image
+/// is written one row of chunks at a time, so memory use does not grow with the height of the level. Returns false
+/// if writing failed.
+bool chunk_render_level(FILE* fp, const chunkconfig& config, const std::function<void(chunk& c)>& generate, int format, int scale = 1, int threads = 0);
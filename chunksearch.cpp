@@ -0,0 +1,138 @@
+#include "chunksearch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+search_pipeline search_pipeline_chunkgen(int method)
+{
+	return [method](chunk& c, int stage)
+	{
+		seed s = c.config.orig; // the chunkgen pipeline rolls its parameters from a copy of the original seed
+		switch (stage)
+		{
+		case SEARCH_SKELETON:
+			c.generate_exits();
+			switch (method)
+			{
+			case 2: return chunk_filter_connect_exits_grand_central(c);
+			case 1: return chunk_filter_connect_exits_inner_loop(c);
+			case 0: chunk_filter_connect_exits(c); return true; // always works
+			default: assert(false); return false;
+			}
+		case SEARCH_ROOMS:
+		{
+			const int iter = s.roll(2, 8);
+			chunk_filter_room_expand(c, iter, iter + 6);
+			chunk_filter_room_in_room(c);
+			chunk_filter_one_way_doors(c, s.roll(0, 4));
+			c.beautify();
+			return true;
+		}
+		case SEARCH_POPULATED:
+		{
+			room& r = chunk_filter_boss_placement(c, 0);
+			chunk_filter_protect_room(c, r);
+			chunk_filter_wildlife(c);
+			chunk_filter_chest(c);
+			return true;
+		}
+		}
+		return false;
+	};
+}
+
+search_result seed_search(const std::function<chunkconfig(uint64_t value)>& make_config, const search_pipeline& pipeline,
+                          const std::vector<search_predicate>& predicates, const search_options& options)
+{
+	search_result result;
+	std::mutex lock; // protects result
+	std::atomic<uint64_t> next(0);
+	std::atomic<int> found(0);
+	const int threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (int t = 0; t < threads; t++)
+	{
+		pool.emplace_back([&]
+		{
+			uint64_t evaluated = 0;
+			uint64_t rejected[SEARCH_STAGES] = {};
+			std::vector<uint64_t> matches;
+			// Stop handing out seeds once we have enough, but always evaluate a seed once it is handed out, so
+			// that every seed below the highest one tried is known and the lowest matches are exact.
+			while (found.load(std::memory_order_relaxed) < options.max_matches)
+			{
+				const uint64_t i = next++;
+				if (i >= options.count) break;
+				const uint64_t value = options.first + i;
+				chunk c(make_config(value));
+				bool ok = true;
+				for (int stage = 0; stage < SEARCH_STAGES && ok; stage++)
+				{
+					ok = pipeline(c, stage);
+					for (unsigned j = 0; j < predicates.size() && ok; j++) if (predicates[j].stage == stage) ok = predicates[j].test(c);
+					if (!ok) rejected[stage]++;
+				}
+				evaluated++;
+				if (ok)
+				{
+					matches.push_back(value);
+					found++;
+				}
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			result.evaluated += evaluated;
+			for (int stage = 0; stage < SEARCH_STAGES; stage++) result.rejected[stage] += rejected[stage];
+			result.matches.insert(result.matches.end(), matches.begin(), matches.end());
+		});
+	}
+	for (std::thread& t : pool) t.join();
+	std::sort(result.matches.begin(), result.matches.end());
+	if ((int)result.matches.size() > options.max_matches) result.matches.resize(options.max_matches);
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+const room* chunk_boss_room(const chunk& c)
+{
+	for (const entity& e : c.entities) if (e.type == ENTITY_BOSS) return &c.rooms.at(e.room_index);
+	return nullptr;
+}
+
+const room* chunk_chest_room(const chunk& c)
+{
+	for (const entity& e : c.entities) if (e.type == TILE_CHEST) return &c.rooms.at(e.room_index);
+	return nullptr;
+}
+
+int chunk_one_way_door_count(const chunk& c)
+{
+	int count = 0;
+	for (int y = 0; y < c.height; y++)
+	{
+		for (int x = 0; x < c.width; x++)
+		{
+			const uint8_t t = c.at(x, y);
+			if (t == TILE_ONE_WAY_TOP || t == TILE_ONE_WAY_BOTTOM || t == TILE_ONE_WAY_LEFT || t == TILE_ONE_WAY_RIGHT) count++;
+		}
+	}
+	return count;
+}
+
+int chunk_skeleton_layout(const chunk& c)
+{
+	for (const room& r : c.rooms) if (!(r.flags & ROOM_FLAG_CORRIDOR)) return 2; // grand central adds a proper room
+	if (c.rooms.size() >= 4)
+	{
+		const room& top = c.rooms[0];
+		const room& bottom = c.rooms[1];
+		const room& left = c.rooms[2];
+		const room& right = c.rooms[3];
+		if (top.y1 == top.y2 && bottom.y1 == bottom.y2 && left.x1 == left.x2 && right.x1 == right.x2 && top.x1 == bottom.x1
+		    && top.x2 == bottom.x2 && left.x1 == top.x1 && right.x1 == top.x2 && left.y1 == top.y1 && left.y2 == bottom.y1) return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+// Chunksearch - find seeds that generate chunks with wanted properties
+
+#pragma once
+
+#include "chunky.h"
+
+#include <functional>
+#include <vector>
+
+/// Stages of a staged generation pipeline. Predicates are checked as soon as the stage they need is done,
+/// so that most seeds can be rejected before the expensive stages run.
+enum search_stage
+{
+	SEARCH_SKELETON, // exits and connecting corridors
+	SEARCH_ROOMS, // rooms, nested rooms, doors
+	SEARCH_POPULATED, // boss, mobs and treasure
+	SEARCH_STAGES
+};
+
+/// Runs one stage of a generation pipeline on a chunk. Stages are always run in order on the same chunk.
+/// Returns false if generation failed, which rejects the seed.
+typedef std::function<bool(chunk& c, int stage)> search_pipeline;
+
+/// The pipeline chunkgen uses, split into stages. 'method' selects the exit connector as in chunkgen --method:
+/// 0 is chunk_filter_connect_exits, 1 the inner loop and 2 grand central.
+search_pipeline search_pipeline_chunkgen(int method = 0);
+
+/// A property we want a chunk to have, and the earliest stage after which it can be checked.
+struct search_predicate
+{
+	int stage;
+	std::function<bool(const chunk& c)> test;
+};
+
+struct search_options
+{
+	uint64_t first = 0; // first seed to try
+	uint64_t count = 1000000; // number of seeds to try at most
+	int threads = 0; // zero for one per core
+	int max_matches = 1; // stop once this many are found
+};
+
+struct search_result
+{
+	std::vector<uint64_t> matches; // lowest matching seeds, in order
+	uint64_t evaluated = 0; // seeds tried
+	uint64_t rejected[SEARCH_STAGES] = {}; // seeds rejected after each stage
+	double seconds = 0.0;
+};
+
+/// Try seeds in order on all cores until enough of them generate chunks that satisfy all the predicates. The config for
+/// each seed value is made by 'make_config'. Seeds are handed out in order, so the matches returned are always the lowest
+/// matching seeds, no matter how many threads are used.
+search_result seed_search(const std::function<chunkconfig(uint64_t value)>& make_config, const search_pipeline& pipeline,
+                          const std::vector<search_predicate>& predicates, const search_options& options);
+
+// -- Chunk property helpers --
+
+/// The room the boss was placed in, or null if none.
+const room* chunk_boss_room(const chunk& c);
+
+/// The room the chest was placed in, or null if none.
+const room* chunk_chest_room(const chunk& c);
+
+/// Number of one-way doors.
+int chunk_one_way_door_count(const chunk& c);
+
+/// Which exit connector made the skeleton of this chunk, numbered like the 'method' of search_pipeline_chunkgen().
+/// Only reliable right after the skeleton stage.
+int chunk_skeleton_layout(const chunk& c);
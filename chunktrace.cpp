@@ -0,0 +1,147 @@
+#include "chunktrace.h"
+#include "chunky.h"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> chunk_trace_active{false};
+
+struct trace_event
+{
+	const char* name;
+	uint64_t ts; // nanoseconds since trace epoch
+	bool begin;
+	bool has_chunk;
+	int64_t x;
+	int64_t y;
+	uint64_t seed;
+};
+
+struct trace_buffer
+{
+	int tid;
+	std::vector<trace_event> events;
+};
+
+static std::mutex registry_lock; // only taken when a thread records its first event, and when writing
+static std::vector<std::shared_ptr<trace_buffer>> registry;
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+static std::string env_filename;
+
+static trace_buffer& local_buffer()
+{
+	thread_local std::shared_ptr<trace_buffer> buffer;
+	if (!buffer)
+	{
+		buffer = std::make_shared<trace_buffer>();
+		buffer->events.reserve(4096);
+		std::lock_guard<std::mutex> guard(registry_lock);
+		buffer->tid = (int)registry.size() + 1;
+		registry.push_back(buffer);
+	}
+	return *buffer;
+}
+
+static inline uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void chunk_trace_begin(const char* name, const chunk* c)
+{
+	trace_event e = { name, now(), true, c != nullptr, 0, 0, 0 };
+	if (c)
+	{
+		e.x = c->config.x;
+		e.y = c->config.y;
+		e.seed = c->config.orig.orig;
+	}
+	local_buffer().events.push_back(e);
+}
+
+void chunk_trace_begin(int stage, const chunk* c)
+{
+	chunk_trace_begin(chunk_stage_name(stage), c);
+}
+
+void chunk_trace_end()
+{
+	local_buffer().events.push_back({ nullptr, now(), false, false, 0, 0, 0 });
+}
+
+void chunk_trace_start()
+{
+	chunk_trace_active.store(true, std::memory_order_relaxed);
+}
+
+void chunk_trace_stop()
+{
+	chunk_trace_active.store(false, std::memory_order_relaxed);
+}
+
+void chunk_trace_clear()
+{
+	std::lock_guard<std::mutex> guard(registry_lock);
+	for (auto& b : registry) b->events.clear();
+}
+
+size_t chunk_trace_event_count()
+{
+	std::lock_guard<std::mutex> guard(registry_lock);
+	size_t count = 0;
+	for (auto& b : registry) count += b->events.size();
+	return count;
+}
+
+bool chunk_trace_write(const char* filename)
+{
+	FILE* fp = fopen(filename, "w");
+	if (!fp) return false;
+	std::lock_guard<std::mutex> guard(registry_lock);
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (auto& b : registry)
+	{
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", first ? "" : ",\n", b->tid, b->tid);
+		first = false;
+		for (const trace_event& e : b->events)
+		{
+			if (!e.begin)
+			{
+				fprintf(fp, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", b->tid, e.ts / 1000.0);
+			}
+			else if (e.has_chunk)
+			{
+				fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"chunky\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"seed\":\"%llu\",\"x\":%lld,\"y\":%lld}}",
+				        e.name, b->tid, e.ts / 1000.0, (unsigned long long)e.seed, (long long)e.x, (long long)e.y);
+			}
+			else
+			{
+				fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"chunky\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", e.name, b->tid, e.ts / 1000.0);
+			}
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	const bool ok = (ferror(fp) == 0);
+	return fclose(fp) == 0 && ok;
+}
+
+static void write_env_trace()
+{
+	chunk_trace_stop();
+	if (!chunk_trace_write(env_filename.c_str())) fprintf(stderr, "Could not write trace to %s\n", env_filename.c_str());
+}
+
+void chunk_trace_init_from_env()
+{
+	const char* filename = getenv("CHUNKY_TRACE");
+	if (!filename || !*filename || !env_filename.empty()) return;
+	env_filename = filename;
+	chunk_trace_start();
+	atexit(write_env_trace);
+}
@@ -0,0 +1,52 @@
+// Chunktrace - timeline of chunk generation, exported as Chrome trace events
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+struct chunk;
+
+extern std::atomic<bool> chunk_trace_active;
+
+/// Start recording trace events from all threads.
+void chunk_trace_start();
+
+/// Stop recording. Recorded events are kept until cleared.
+void chunk_trace_stop();
+
+/// Throw away all recorded events. Nobody may be recording at the same time.
+void chunk_trace_clear();
+
+/// Write all recorded events in Chrome trace event format, which can be viewed in chrome://tracing or
+/// ui.perfetto.dev. Nobody may be recording at the same time. Returns false if the file could not be written.
+bool chunk_trace_write(const char* filename);
+
+/// If the CHUNKY_TRACE environment variable is set, start recording and write the trace to the file
+/// it names when the program exits.
+void chunk_trace_init_from_env();
+
+/// Number of events recorded so far.
+size_t chunk_trace_event_count();
+
+inline bool chunk_trace_enabled() { return chunk_trace_active.load(std::memory_order_relaxed); }
+
+void chunk_trace_begin(const char* name, const chunk* c);
+void chunk_trace_begin(int stage, const chunk* c);
+void chunk_trace_end();
+
+/// Records a begin event when created and an end event when destroyed, if tracing is enabled. Events
+/// are stored in a buffer owned by the recording thread, so recording never takes a lock. If given a
+/// chunk, its seed and position are recorded with the begin event.
+struct chunk_trace_scope
+{
+	chunk_trace_scope(const char* name, const chunk* c = nullptr) : _active(chunk_trace_enabled()) { if (_active) chunk_trace_begin(name, c); }
+	chunk_trace_scope(int stage, const chunk* c) : _active(chunk_trace_enabled()) { if (_active) chunk_trace_begin(stage, c); }
+	~chunk_trace_scope() { if (_active) chunk_trace_end(); }
+	chunk_trace_scope(const chunk_trace_scope&) = delete;
+	chunk_trace_scope& operator=(const chunk_trace_scope&) = delete;
+
+private:
+	bool _active;
+};
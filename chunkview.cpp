@@ -3,47 +3,89 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 
-chunkview::chunkview(const chunkconfig &c, int width, int height)
-    : _config(c), _width(width), _height(height)
+chunkview::chunkview(const chunkconfig &c, int width, int height, chunk_generator gen)
+    : chunkview(*new chunkcache(c, gen), width, height)
+{
+	_owned_cache.reset(_cache);
+	if (_config.unbounded)
+		_cache->set_budget((size_t)(_width / _chunk_width + 4) * (_height / _chunk_height + 4) * 4);
+}
+
+chunkview::chunkview(chunkcache &cache, int width, int height)
+    : _cache(&cache), _width(width), _height(height), _viewport(width * height, TILE_ROCK), _config(cache.config())
 {
 	// Create a dummy chunk to get the chunk dimensions
 	chunk dummy_chunk(_config);
 	_chunk_width = dummy_chunk.width;
 	_chunk_height = dummy_chunk.height;
+	if (_config.unbounded)
+		_pack_margin = 1;
+}
+
+bool chunkview::set_seams(bool enable)
+{
+	if (enable && !_owned_cache)
+		return false;
+	_seams = enable;
+	return true;
 }
 
-static int floor_div(int value, int divisor)
+static int64_t floor_div(int64_t value, int64_t divisor)
 {
 	assert(divisor > 0);
-	int q = value / divisor;
-	int r = value % divisor;
+	int64_t q = value / divisor;
+	int64_t r = value % divisor;
 	if (r != 0 && value < 0)
 		--q;
 	return q;
 }
 
-void chunkview::change_position(int x, int y)
+void chunkview::change_position(int64_t x, int64_t y)
 {
+	chunk_trace_scope trace("change_position");
+	load_chunks(x, y);
+	update_viewport();
+}
+
+void chunkview::load_chunks(int64_t x, int64_t y)
+{
+	if (_positioned)
+	{
+		const int64_t scroll_x = _changes.scroll_x + (x - _current_x);
+		const int64_t scroll_y = _changes.scroll_y + (y - _current_y);
+		if (std::max(std::abs(scroll_x), std::abs(scroll_y)) >= (1 << 30))
+			_changes.full = true; // teleported; only the new place matters
+		else
+		{
+			_changes.scroll_x = scroll_x;
+			_changes.scroll_y = scroll_y;
+		}
+	}
+	_positioned = true;
 	_current_x = x;
 	_current_y = y;
 
-	int view_x_start = _current_x - _width / 2;
-	int view_y_start = _current_y - _height / 2;
-	int view_x_end = view_x_start + _width - 1;
-	int view_y_end = view_y_start + _height - 1;
+	int64_t view_x_start = _current_x - _width / 2;
+	int64_t view_y_start = _current_y - _height / 2;
+	int64_t view_x_end = view_x_start + _width - 1;
+	int64_t view_y_end = view_y_start + _height - 1;
 
-	int chunk_x_start = floor_div(view_x_start, _chunk_width);
-	int chunk_y_start = floor_div(view_y_start, _chunk_height);
-	int chunk_x_end = floor_div(view_x_end, _chunk_width);
-	int chunk_y_end = floor_div(view_y_end, _chunk_height);
+	int64_t chunk_x_start = floor_div(view_x_start, _chunk_width);
+	int64_t chunk_y_start = floor_div(view_y_start, _chunk_height);
+	int64_t chunk_x_end = floor_div(view_x_end, _chunk_width);
+	int64_t chunk_y_end = floor_div(view_y_end, _chunk_height);
 
-	const int max_chunk_x = _config.level_width - 1;
-	const int max_chunk_y = _config.level_height - 1;
-	int clamped_x_start = std::max(0, chunk_x_start);
-	int clamped_y_start = std::max(0, chunk_y_start);
-	int clamped_x_end = std::min(max_chunk_x, chunk_x_end);
-	int clamped_y_end = std::min(max_chunk_y, chunk_y_end);
+	// Unbounded worlds have no edges, but keep well clear of overflowing when adding margins
+	const int64_t min_chunk = _config.unbounded ? INT64_MIN / 4 : 0;
+	const int64_t max_chunk_x = _config.unbounded ? INT64_MAX / 4 : _config.level_width - 1;
+	const int64_t max_chunk_y = _config.unbounded ? INT64_MAX / 4 : _config.level_height - 1;
+	int64_t clamped_x_start = std::max(min_chunk, chunk_x_start);
+	int64_t clamped_y_start = std::max(min_chunk, chunk_y_start);
+	int64_t clamped_x_end = std::min(max_chunk_x, chunk_x_end);
+	int64_t clamped_y_end = std::min(max_chunk_y, chunk_y_end);
 
 	if (clamped_x_start > clamped_x_end || clamped_y_start > clamped_y_end)
 	{
@@ -62,9 +104,15 @@ void chunkview::change_position(int x, int y)
 		return;
 	}
 
-	for (int cy = clamped_y_start; cy <= clamped_y_end; ++cy)
+	// Chunks in view get full detail, chunks in the margin around it their rooms and then only their skeleton
+	const int margin = std::max(_rooms_margin, _skeleton_margin);
+	const int64_t ring_x_start = std::max(min_chunk, clamped_x_start - margin);
+	const int64_t ring_y_start = std::max(min_chunk, clamped_y_start - margin);
+	const int64_t ring_x_end = std::min(max_chunk_x, clamped_x_end + margin);
+	const int64_t ring_y_end = std::min(max_chunk_y, clamped_y_end + margin);
+	for (int64_t cy = ring_y_start; cy <= ring_y_end; ++cy)
 	{
-		for (int cx = clamped_x_start; cx <= clamped_x_end; ++cx)
+		for (int64_t cx = ring_x_start; cx <= ring_x_end; ++cx)
 		{
 			if (has_bounds &&
 			    cx >= _chunk_x_start && cx <= _chunk_x_end &&
@@ -72,19 +120,34 @@ void chunkview::change_position(int x, int y)
 			{
 				continue;
 			}
-			coords chunk_coords = {cx, cy};
-			if (chunks.find(chunk_coords) == chunks.end())
+			const int64_t distance = std::max(std::max(clamped_x_start - cx, cx - clamped_x_end),
+			                                  std::max(clamped_y_start - cy, cy - clamped_y_end));
+			const bool visible = (distance <= 0);
+			const int wanted = visible ? DETAIL_FULL : distance <= _rooms_margin ? DETAIL_ROOMS : DETAIL_SKELETON;
+			coords chunk_coords = {cx, cy, _floor};
+			auto it = chunks.find(chunk_coords);
+			bool loaded = true;
+			if (it == chunks.end())
+			{
+				chunks.emplace(chunk_coords, _cache->pin(chunk_coords, wanted));
+			}
+			else if (it->second.detail() < wanted)
+			{
+				it->second.release(); // so the cache can upgrade it in place rather than copy it for us
+				it->second = _cache->pin(chunk_coords, wanted);
+			}
+			else
+			{
+				loaded = false;
+			}
+			// New and upgraded chunks have new entities; others may have been pinned again on tile access without
+			// being indexed
+			if (visible && (loaded || !_room_entities.count(chunk_coords)))
+				index_entities(chunk_coords);
+			if (visible && loaded)
 			{
-				chunkconfig fresh_config = _config;
-				fresh_config.x = cx;
-				fresh_config.y = cy;
-				chunk new_chunk(fresh_config);
-				new_chunk.generate_exits();
-				chunk_filter_connect_exits(new_chunk);
-				chunk_filter_room_expand(new_chunk);
-				chunk_filter_one_way_doors(new_chunk, new_chunk.roll(0, 2));
-				chunk_filter_chest(new_chunk);
-				chunks.emplace(chunk_coords, std::move(new_chunk));
+				_changes.chunks.push_back(chunk_coords);
+				prefetch_stairs(cx, cy);
 			}
 		}
 	}
@@ -93,76 +156,473 @@ void chunkview::change_position(int x, int y)
 	_chunk_x_end = clamped_x_end;
 	_chunk_y_start = clamped_y_start;
 	_chunk_y_end = clamped_y_end;
+
+	if (_seams)
+		process_seams(clamped_x_start, clamped_y_start, clamped_x_end, clamped_y_end);
+	if (_pack_margin >= 0)
+	{
+		pack_chunks(ring_x_start - _pack_margin, ring_y_start - _pack_margin, ring_x_end + _pack_margin, ring_y_end + _pack_margin);
+	}
+	_cache->trim();
+}
+
+void chunkview::pack_chunks(int64_t x1, int64_t y1, int64_t x2, int64_t y2)
+{
+	std::vector<coords> leaving;
+	for (const auto& it : chunks)
+	{
+		if (it.first.x < x1 || it.first.x > x2 || it.first.y < y1 || it.first.y > y2) leaving.push_back(it.first);
+	}
+	for (const coords& cc : leaving)
+		release_chunk(cc);
+}
+
+void chunkview::release_chunk(coords cc)
+{
+	unindex_entities(cc);
+	chunks.erase(cc); // drops our pin
+	_cache->pack(cc); // fails harmlessly if another view still has it pinned
+}
+
+void chunkview::index_entities(coords cc)
+{
+	unindex_entities(cc);
+	const chunk &c = *chunks.at(cc);
+	std::vector<std::vector<chunkview_entity>> &rooms = _room_entities[cc];
+	rooms.resize(c.rooms.size());
+	const int64_t ox = cc.x * _chunk_width;
+	const int64_t oy = cc.y * _chunk_height;
+	for (const entity &e : c.entities)
+	{
+		const chunkview_entity we = { ox + e.x, oy + e.y, e.type, e.room_index, cc };
+		_entity_grid[{floor_div(we.x, ENTITY_CELL), floor_div(we.y, ENTITY_CELL)}].push_back(we);
+		rooms.at(e.room_index).push_back(we);
+	}
+}
+
+void chunkview::unindex_entities(coords cc)
+{
+	auto it = _room_entities.find(cc);
+	if (it == _room_entities.end())
+		return;
+	for (const auto &room : it->second)
+	{
+		for (const chunkview_entity &we : room)
+		{
+			const coords cell = {floor_div(we.x, ENTITY_CELL), floor_div(we.y, ENTITY_CELL)};
+			auto cit = _entity_grid.find(cell);
+			if (cit == _entity_grid.end())
+				continue; // already cleared for an earlier entity of ours
+			std::vector<chunkview_entity> &list = cit->second;
+			list.erase(std::remove_if(list.begin(), list.end(), [&cc](const chunkview_entity &o) { return o.chunk == cc; }), list.end());
+			if (list.empty())
+				_entity_grid.erase(cit);
+		}
+	}
+	_room_entities.erase(it);
+}
+
+void chunkview::entities_in_rect(int64_t x1, int64_t y1, int64_t x2, int64_t y2, std::vector<chunkview_entity> &out) const
+{
+	for (int64_t gy = floor_div(y1, ENTITY_CELL); gy <= floor_div(y2, ENTITY_CELL); ++gy)
+	{
+		for (int64_t gx = floor_div(x1, ENTITY_CELL); gx <= floor_div(x2, ENTITY_CELL); ++gx)
+		{
+			auto it = _entity_grid.find({gx, gy});
+			if (it == _entity_grid.end())
+				continue;
+			for (const chunkview_entity &we : it->second)
+			{
+				if (we.x >= x1 && we.x <= x2 && we.y >= y1 && we.y <= y2)
+					out.push_back(we);
+			}
+		}
+	}
+}
+
+void chunkview::entities_in_radius(int64_t x, int64_t y, int64_t radius, std::vector<chunkview_entity> &out) const
+{
+	const size_t first = out.size();
+	entities_in_rect(x - radius, y - radius, x + radius, y + radius, out);
+	out.erase(std::remove_if(out.begin() + first, out.end(), [&](const chunkview_entity &we)
+	{
+		return (we.x - x) * (we.x - x) + (we.y - y) * (we.y - y) > radius * radius;
+	}), out.end());
+}
+
+const std::vector<chunkview_entity> &chunkview::room_entities(coords chunk, int room_index) const
+{
+	static const std::vector<chunkview_entity> none;
+	auto it = _room_entities.find(chunk);
+	if (it == _room_entities.end() || room_index < 0 || room_index >= (int)it->second.size())
+		return none;
+	return it->second[room_index];
+}
+
+void chunkview::prefetch_stairs(int64_t cx, int64_t cy)
+{
+	// Only the corridor skeleton; it is upgraded when someone takes the stairs
+	for (int z = _floor - 1; z <= _floor + 1; z += 2)
+	{
+		const coords cc = {cx, cy, z};
+		if (_config.stairs(cx, cy, std::min(z, _floor)) && chunks.find(cc) == chunks.end())
+			chunks.emplace(cc, _cache->pin(cc, DETAIL_SKELETON));
+	}
+}
+
+void chunkview::process_seams(int64_t x1, int64_t y1, int64_t x2, int64_t y2)
+{
+	static const int dirs[4] = { DIR_UP, DIR_RIGHT, DIR_DOWN, DIR_LEFT };
+	for (int64_t cy = y1; cy <= y2; ++cy)
+	{
+		for (int64_t cx = x1; cx <= x2; ++cx)
+		{
+			chunk *c = chunks.at({cx, cy, _floor}).get();
+			for (int dir : dirs)
+			{
+				if (c->seams & dir)
+					continue;
+				const int64_t nx = cx + (dir == DIR_RIGHT) - (dir == DIR_LEFT);
+				const int64_t ny = cy + (dir == DIR_DOWN) - (dir == DIR_UP);
+				auto it = chunks.find({nx, ny, _floor});
+				if (it == chunks.end() || it->second.detail() < DETAIL_FULL)
+					continue;
+				// Always go left to right or top to bottom
+				const bool forward = (dir == DIR_RIGHT || dir == DIR_DOWN);
+				chunk &first = forward ? *c : *it->second;
+				chunk &second = forward ? *it->second : *c;
+				if (chunk_filter_seam(first, second, (dir == DIR_LEFT || dir == DIR_RIGHT) ? DIR_RIGHT : DIR_DOWN) == 0)
+					continue;
+				const int64_t sx = std::max(cx, nx) * _chunk_width; // world coordinates of the seam
+				const int64_t sy = std::max(cy, ny) * _chunk_height;
+				if (dir == DIR_LEFT || dir == DIR_RIGHT)
+					refresh_tiles(sx - 2, cy * _chunk_height, sx + 1, cy * _chunk_height + _chunk_height - 1);
+				else
+					refresh_tiles(cx * _chunk_width, sy - 2, cx * _chunk_width + _chunk_width - 1, sy + 1);
+			}
+		}
+	}
+}
+
+void chunkview::refresh_tiles(int64_t x1, int64_t y1, int64_t x2, int64_t y2)
+{
+	if (!_viewport_valid)
+		return;
+	for (int64_t wy = std::max(y1, _viewport_y); wy <= std::min(y2, _viewport_y + _height - 1); ++wy)
+	{
+		for (int64_t wx = std::max(x1, _viewport_x); wx <= std::min(x2, _viewport_x + _width - 1); ++wx)
+		{
+			uint8_t &cell = _viewport[(wy - _viewport_y) * _width + wx - _viewport_x];
+			const tile_type t = get_tile(wx, wy);
+			if (cell == t)
+				continue;
+			cell = t;
+			note_change(wx, wy);
+		}
+	}
+}
+
+void chunkview::set_floor(int z)
+{
+	assert(z >= 0 && z < _config.floors);
+	if (z == _floor)
+		return;
+	_floor = z;
+	std::vector<coords> leaving;
+	for (const auto& it : chunks)
+	{
+		if (it.first.z != z)
+			leaving.push_back(it.first);
+	}
+	for (const coords& cc : leaving)
+		release_chunk(cc);
+
+	// Load everything around us anew
+	_chunk_x_start = 0;
+	_chunk_x_end = -1;
+	_chunk_y_start = 0;
+	_chunk_y_end = -1;
+	_viewport_valid = false;
+	_changes.full = true;
+	if (_positioned)
+		change_position(_current_x, _current_y);
+}
+
+chunk* chunkview::refind(coords c) const
+{
+	if (_pack_margin < 0) return nullptr; // we never let go of chunks, so it was never generated
+	chunkpin p = _cache->find(c);
+	if (!p) return nullptr;
+	chunk* found = p.get();
+	chunks.emplace(c, std::move(p));
+	return found;
+}
+
+void chunkview::update_viewport()
+{
+	const int64_t far_x = view_x() - _viewport_x;
+	const int64_t far_y = view_y() - _viewport_y;
+	_viewport_x = view_x();
+	_viewport_y = view_y();
+	if (!_viewport_valid || std::abs(far_x) >= _width || std::abs(far_y) >= _height)
+	{
+		_viewport_valid = true;
+		fill_viewport(0, 0, _width - 1, _height - 1);
+		return;
+	}
+	const int dx = (int)far_x;
+	const int dy = (int)far_y;
+	if (dx == 0 && dy == 0)
+		return;
+
+	// Move what we still see into place, going through the rows in an order that never overwrites
+	// a row before it has been moved
+	uint8_t *tiles = _viewport.data();
+	const int keep = _width - abs(dx);
+	const int to = std::max(0, -dx);
+	const int from = std::max(0, dx);
+	if (dy >= 0)
+	{
+		for (int vy = 0; vy < _height - dy; ++vy)
+			memmove(tiles + vy * _width + to, tiles + (vy + dy) * _width + from, keep);
+	}
+	else
+	{
+		for (int vy = _height - 1; vy >= -dy; --vy)
+			memmove(tiles + vy * _width + to, tiles + (vy + dy) * _width + from, keep);
+	}
+
+	// Then fetch only what came into view
+	if (dx > 0)
+		fill_viewport(_width - dx, 0, _width - 1, _height - 1);
+	else if (dx < 0)
+		fill_viewport(0, 0, -dx - 1, _height - 1);
+	if (dy > 0)
+		fill_viewport(0, _height - dy, _width - 1, _height - 1);
+	else if (dy < 0)
+		fill_viewport(0, 0, _width - 1, -dy - 1);
+}
+
+void chunkview::fill_viewport(int x1, int y1, int x2, int y2)
+{
+	for (int vy = y1; vy <= y2; ++vy)
+	{
+		uint8_t *row = _viewport.data() + vy * _width;
+		const int64_t wy = _viewport_y + vy;
+		int vx = x1;
+		while (vx <= x2)
+		{
+			// Copy a run of tiles from one chunk at a time
+			const int64_t wx = _viewport_x + vx;
+			const int64_t cx = floor_div(wx, _chunk_width);
+			const int tile_x = (int)(wx - cx * _chunk_width);
+			const int run = std::min(x2 - vx + 1, _chunk_width - tile_x);
+			const chunk *c = get_chunk_at(wx, wy);
+			if (c)
+			{
+				const int tile_y = (int)(wy - floor_div(wy, _chunk_height) * _chunk_height);
+				memcpy(row + vx, c->tiles() + tile_y * _chunk_width + tile_x, run);
+			}
+			else
+			{
+				memset(row + vx, TILE_ROCK, run);
+			}
+			vx += run;
+		}
+	}
 }
 
 void chunkview::self_test() const
 {
 	assert(_width > 0);
 	assert(_height > 0);
+	if (_viewport_valid)
+	{
+		for (int vy = 0; vy < _height; ++vy)
+			for (int vx = 0; vx < _width; ++vx)
+				assert(_viewport[vy * _width + vx] == get_tile(_viewport_x + vx, _viewport_y + vy));
+	}
+	for (int64_t cy = _chunk_y_start; cy <= _chunk_y_end; ++cy)
+	{
+		for (int64_t cx = _chunk_x_start; cx <= _chunk_x_end; ++cx)
+		{
+			assert(chunks.count({cx, cy, _floor}) && chunks.at({cx, cy, _floor}).detail() == DETAIL_FULL);
+			assert(_room_entities.count({cx, cy, _floor}));
+		}
+	}
+	size_t indexed = 0;
+	for (const auto &it : _room_entities)
+	{
+		assert(chunks.count(it.first));
+		for (const auto &room : it.second)
+			indexed += room.size();
+	}
+	size_t gridded = 0;
+	for (const auto &it : _entity_grid)
+		gridded += it.second.size();
+	assert(indexed == gridded);
 }
 
-const chunk *chunkview::get_chunk_at(int world_x, int world_y) const
+int chunkview::chunk_detail(int64_t world_x, int64_t world_y, int z) const
 {
-	if (world_x < 0 || world_y < 0)
-		return nullptr;
-	const int world_width = _config.level_width * _chunk_width;
-	const int world_height = _config.level_height * _chunk_height;
-	if (world_x >= world_width || world_y >= world_height)
+	if (z == _floor && !get_chunk_at(world_x, world_y)) // may pin a packed chunk again
+		return DETAIL_NONE;
+	coords cc = {floor_div(world_x, _chunk_width),
+	             floor_div(world_y, _chunk_height), z};
+	auto it = chunks.find(cc);
+	return (it == chunks.end()) ? DETAIL_NONE : it->second.detail();
+}
+
+bool chunkview::in_level(int64_t world_x, int64_t world_y) const
+{
+	if (_config.unbounded)
+		return true;
+	const int64_t world_width = (int64_t)_config.level_width * _chunk_width;
+	const int64_t world_height = (int64_t)_config.level_height * _chunk_height;
+	return world_x >= 0 && world_y >= 0 && world_x < world_width && world_y < world_height;
+}
+
+const chunk *chunkview::get_chunk_at(int64_t world_x, int64_t world_y) const
+{
+	if (!in_level(world_x, world_y))
 		return nullptr;
 	coords c = {floor_div(world_x, _chunk_width),
-	            floor_div(world_y, _chunk_height)};
+	            floor_div(world_y, _chunk_height), _floor};
 	auto it = chunks.find(c);
 	if (it != chunks.end())
 	{
-		return &it->second;
+		return it->second.get();
 	}
-	return nullptr;
+	return refind(c);
 }
 
-chunk *chunkview::get_chunk_at(int world_x, int world_y)
+chunk *chunkview::get_chunk_at(int64_t world_x, int64_t world_y)
 {
-	if (world_x < 0 || world_y < 0)
-		return nullptr;
-	const int world_width = _config.level_width * _chunk_width;
-	const int world_height = _config.level_height * _chunk_height;
-	if (world_x >= world_width || world_y >= world_height)
+	if (!in_level(world_x, world_y))
 		return nullptr;
 	coords c = {floor_div(world_x, _chunk_width),
-	            floor_div(world_y, _chunk_height)};
+	            floor_div(world_y, _chunk_height), _floor};
 	auto it = chunks.find(c);
 	if (it != chunks.end())
 	{
-		return &it->second;
+		return it->second.get();
 	}
-	return nullptr;
+	return refind(c);
 }
 
-tile_type chunkview::get_tile(int world_x, int world_y) const
+tile_type chunkview::get_tile(int64_t world_x, int64_t world_y) const
 {
 	const chunk *c = get_chunk_at(world_x, world_y);
 	if (!c)
 		return TILE_ROCK; // Should not happen if change_position is called
 		                  // before
 
-	int chunk_x = floor_div(world_x, _chunk_width);
-	int chunk_y = floor_div(world_y, _chunk_height);
+	int64_t chunk_x = floor_div(world_x, _chunk_width);
+	int64_t chunk_y = floor_div(world_y, _chunk_height);
 
-	int tile_x = world_x - chunk_x * _chunk_width;
-	int tile_y = world_y - chunk_y * _chunk_height;
+	int tile_x = (int)(world_x - chunk_x * _chunk_width);
+	int tile_y = (int)(world_y - chunk_y * _chunk_height);
 
 	return (tile_type)c->at(tile_x, tile_y);
 }
 
-void chunkview::set_tile(int world_x, int world_y, tile_type t)
+void chunkview::set_tile(int64_t world_x, int64_t world_y, tile_type t)
 {
 	chunk *c = get_chunk_at(world_x, world_y);
 	if (c)
 	{
-		int chunk_x = floor_div(world_x, _chunk_width);
-		int chunk_y = floor_div(world_y, _chunk_height);
+		int64_t chunk_x = floor_div(world_x, _chunk_width);
+		int64_t chunk_y = floor_div(world_y, _chunk_height);
 
-		int tile_x = world_x - chunk_x * _chunk_width;
-		int tile_y = world_y - chunk_y * _chunk_height;
+		int tile_x = (int)(world_x - chunk_x * _chunk_width);
+		int tile_y = (int)(world_y - chunk_y * _chunk_height);
 		c->build(tile_x, tile_y, t);
+		c->update_mip(tile_x, tile_y);
+		if (_viewport_valid && world_x >= _viewport_x && world_x < _viewport_x + _width && world_y >= _viewport_y && world_y < _viewport_y + _height)
+			_viewport[(world_y - _viewport_y) * _width + world_x - _viewport_x] = t;
+		note_change(world_x, world_y);
+	}
+}
+
+uint8_t chunkview::get_mip(int level, int64_t world_x, int64_t world_y) const
+{
+	assert(level >= 1 && level <= chunkmip::LEVELS);
+	const chunk *c = get_chunk_at(world_x, world_y);
+	if (!c || !c->mip.built())
+		return 0;
+	const int tile_x = (int)(world_x - floor_div(world_x, _chunk_width) * _chunk_width);
+	const int tile_y = (int)(world_y - floor_div(world_y, _chunk_height) * _chunk_height);
+	return c->mip.at(level, tile_x, tile_y);
+}
+
+void chunkview::find_features(int f, int64_t x1, int64_t y1, int64_t x2, int64_t y2, std::vector<coords>& out) const
+{
+	for (int64_t cy = floor_div(y1, _chunk_height); cy <= floor_div(y2, _chunk_height); cy++)
+	{
+		for (int64_t cx = floor_div(x1, _chunk_width); cx <= floor_div(x2, _chunk_width); cx++)
+		{
+			const int64_t ox = cx * _chunk_width;
+			const int64_t oy = cy * _chunk_height;
+			const chunk *c = get_chunk_at(ox, oy);
+			if (!c)
+				continue;
+			c->for_each_feature(f, (int)(std::max(x1, ox) - ox), (int)(std::max(y1, oy) - oy),
+			                    (int)(std::min(x2, ox + _chunk_width - 1) - ox), (int)(std::min(y2, oy + _chunk_height - 1) - oy),
+			                    [&](int x, int y) { out.push_back({ox + x, oy + y}); });
+		}
+	}
+}
+
+int chunkview::reroll(int64_t x1, int64_t y1, int64_t x2, int64_t y2, seed s)
+{
+	int count = 0;
+	for (int64_t cy = floor_div(y1, _chunk_height); cy <= floor_div(y2, _chunk_height); cy++)
+	{
+		for (int64_t cx = floor_div(x1, _chunk_width); cx <= floor_div(x2, _chunk_width); cx++)
+		{
+			const int64_t ox = cx * _chunk_width;
+			const int64_t oy = cy * _chunk_height;
+			chunk *c = get_chunk_at(ox, oy);
+			if (!c || chunk_detail(ox, oy) != DETAIL_FULL) // lower detail chunks are not furnished yet
+				continue;
+			const int rerolled = chunk_area_reroll(*c, (int)(std::max(x1, ox) - ox), (int)(std::max(y1, oy) - oy),
+			                                       (int)(std::min(x2, ox + _chunk_width - 1) - ox), (int)(std::min(y2, oy + _chunk_height - 1) - oy),
+			                                       s.derive(chunk::fold(cx), chunk::fold(cy), _floor));
+			if (rerolled == 0)
+				continue;
+			count += rerolled;
+			const coords cc = {cx, cy, _floor};
+			if (_room_entities.count(cc))
+				index_entities(cc);
+			refresh_tiles(ox, oy, ox + _chunk_width - 1, oy + _chunk_height - 1);
+		}
+	}
+	return count;
+}
+
+void chunkview::note_change(int64_t world_x, int64_t world_y)
+{
+	if (world_x >= view_x() && world_x < view_x() + _width && world_y >= view_y() && world_y < view_y() + _height && !_changes.full)
+	{
+		_changes.tiles.push_back({world_x, world_y});
+		if ((int)_changes.tiles.size() > _width * _height / 4) // cheaper to redraw it all
+		{
+			_changes.full = true;
+			_changes.tiles.clear();
+		}
+	}
+}
+
+chunkview_changes chunkview::take_changes()
+{
+	chunkview_changes result = std::move(_changes);
+	_changes = chunkview_changes();
+	_changes.full = false;
+	if (result.full)
+	{
+		result.scroll_x = result.scroll_y = 0;
+		result.tiles.clear();
+		result.chunks.clear();
 	}
+	return result;
 }
@@ -3,25 +3,45 @@
 #pragma once
 
 #include "chunky.h"
+#include "chunkcache.h"
 
+#include <memory>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
-struct coords
+/// What changed in a view since the last chunkview::take_changes(). Tiles outside the view are not tracked,
+/// since they are redrawn anyway when scrolled into view.
+struct chunkview_changes
 {
-	int x;
-	int y;
+	bool full = true; // redraw everything; set until changes are first taken, or if too much happened
+	int scroll_x = 0; // how far the view origin moved, in tiles
+	int scroll_y = 0;
+	std::vector<coords> tiles; // world coordinates of tiles changed by set_tile()
+	std::vector<coords> chunks; // chunk coordinates of chunks that were generated or upgraded while in view
+};
+
+/// Read-only window onto the tiles currently in view, row by row. Valid until the view changes.
+struct viewport_span
+{
+	const uint8_t* tiles;
+	int width;
+	int height;
+	int64_t x; // world coordinates of the top left tile
+	int64_t y;
 
-	bool operator<(const coords& other) const { if (x != other.x) { return x < other.x; } return y < other.y; }
-	bool operator==(const coords& other) const { return x == other.x && y == other.y; }
+	inline uint8_t at(int view_x, int view_y) const { return tiles[view_y * width + view_x]; }
 };
-template<> struct std::hash<coords>
+
+/// An entity of a chunk loaded in a view, in world coordinates.
+struct chunkview_entity
 {
-	size_t operator()(const coords& cc) const
-	{
-		return std::hash<int>()(cc.x) ^ (std::hash<int>()(cc.y) << 1);
-	}
+	int64_t x;
+	int64_t y;
+	tile_type type;
+	int room_index; // in its chunk's room list
+	coords chunk; // chunk coordinates of its chunk
 };
 
 /// A chunkview is a matrix collection of chunks giving you a movable window
@@ -30,42 +50,158 @@ template<> struct std::hash<coords>
 struct chunkview
 {
 	/// Create a chunk view of the given size in tiles you want to observe. We will load
-	/// enough chunks to cover the view.
-	chunkview(const chunkconfig& c, int width, int height);
+	/// enough chunks to cover the view. If the config is unbounded, the view lets go of chunks it walks
+	/// away from, and the cache it makes keeps only a few times as many chunks as cover the view.
+	chunkview(const chunkconfig& c, int width, int height, chunk_generator gen = chunkcache_generate);
+
+	/// Create a chunk view that takes its chunks from a cache shared with other views. The cache
+	/// must outlive the view.
+	chunkview(chunkcache& cache, int width, int height);
 
 	/// Set our current position in world coordinates, updating the view by generating
 	/// new chunks if necessary.
-	void change_position(int x, int y);
+	void change_position(int64_t x, int64_t y);
 
-	/// Get the total row count
+	/// Move to another floor at the same position. Chunks of the floor we leave are released and packed;
+	/// only the floor we are on is kept hot, plus skeletons of the chunks that stairs in view lead to.
+	void set_floor(int z);
+	int floor() const { return _floor; }
+
+	/// Get the total column count
 	int view_width() const { return _width; };
 
 	/// Get the total row count
 	int view_height() const { return _height; };
 
+	/// Size of each chunk in tiles
+	int chunk_width() const { return _chunk_width; }
+	int chunk_height() const { return _chunk_height; }
+
+	/// World coordinates of the top left tile of the view
+	int64_t view_x() const { return _current_x - _width / 2; }
+	int64_t view_y() const { return _current_y - _height / 2; }
+
+	/// All tiles in view in one contiguous buffer, kept up to date by change_position() and set_tile().
+	/// Tiles outside the level are rock.
+	viewport_span viewport() const { return { _viewport.data(), _width, _height, view_x(), view_y() }; }
+
+	/// Hand over what changed since the last call, so that only that needs to be redrawn. Changes made
+	/// to shared chunks through other views are not seen.
+	chunkview_changes take_changes();
+
+	/// Also keep this many chunks around the view generated, but only up to their corridor
+	/// skeleton. They are upgraded to full detail when they come into view. Default is zero.
+	void set_skeleton_margin(int chunks) { _skeleton_margin = chunks; }
+
+	/// Generate this many chunks around the view up to their rooms and doors, inside the skeleton margin
+	/// if that is wider. Default is zero.
+	void set_rooms_margin(int chunks) { _rooms_margin = chunks; }
+
+	/// Release chunks that are more than this many chunks beyond the skeleton and rooms margins, and pack
+	/// their tiles in the cache to save memory. They are unpacked again when they come back, or when their
+	/// tiles are accessed. Default is -1, which keeps every chunk we have seen pinned and unpacked, or 1 if
+	/// the world is unbounded.
+	void set_pack_margin(int chunks) { _pack_margin = chunks; }
+
+	/// Clean up walls along the seams between chunks, once both chunks of a seam are loaded in full detail,
+	/// so that the world looks continuous. Only a thin band along each seam is looked at, once per seam.
+	/// This changes the chunks in place, which other views of a shared cache would not notice, so it is
+	/// refused for views made from a shared cache. Returns whether the setting was taken. Default is off.
+	bool set_seams(bool enable);
+
+	/// The cache we take our chunks from, for its statistics.
+	const chunkcache& cache() const { return *_cache; }
+
+	/// Detail level of the chunk containing the given world coordinates, or DETAIL_NONE if
+	/// it is not loaded. Looks at the current floor, unless another is given.
+	int chunk_detail(int64_t world_x, int64_t world_y) const { return chunk_detail(world_x, world_y, _floor); }
+	int chunk_detail(int64_t world_x, int64_t world_y, int z) const;
+
+	/// Append the entities of chunks in view that stand inside the rectangle (inclusive) to the list. They are
+	/// kept in a grid in world coordinates that is updated as chunks come into view and are released, so this
+	/// only looks at the few grid cells the rectangle covers.
+	void entities_in_rect(int64_t x1, int64_t y1, int64_t x2, int64_t y2, std::vector<chunkview_entity>& out) const;
+	/// As above, for entities no further than radius tiles away from (x, y).
+	void entities_in_radius(int64_t x, int64_t y, int64_t radius, std::vector<chunkview_entity>& out) const;
+	/// Entities of the given room of a chunk in view, in the order the chunk lists them.
+	const std::vector<chunkview_entity>& room_entities(coords chunk, int room_index) const;
+
+	/// Reroll the rooms of full detail chunks that overlap the rectangle (inclusive, world coordinates) with
+	/// chunk_area_reroll(), from a seed derived from the given one for each chunk. Keeps the viewport, the
+	/// changes and the entity index up to date. Returns the number of rooms rerolled.
+	int reroll(int64_t x1, int64_t y1, int64_t x2, int64_t y2, seed s);
+
+	/// Call fn(chunk coordinates, chunk, detail level) for every chunk we hold on the current floor.
+	template<typename F> void for_each_chunk(F fn) const
+	{
+		for (const auto& it : chunks) if (it.first.z == _floor) fn(it.first, (const chunk&)*it.second, it.second.detail());
+	}
+
 	/// A bunch of assertions to verify that our internal state is still good.
 	void self_test() const;
 
-	tile_type get_tile(int world_x, int world_y) const;
-	void set_tile(int world_x, int world_y, tile_type t);
+	tile_type get_tile(int64_t world_x, int64_t world_y) const;
+	void set_tile(int64_t world_x, int64_t world_y, tile_type t);
+
+	/// Coarse query: the mip_flags of the 2^level by 2^level tile cell (level 1 to chunkmip::LEVELS) covering
+	/// the given world coordinates, on the current floor. Zero if that chunk is not loaded.
+	uint8_t get_mip(int level, int64_t world_x, int64_t world_y) const;
+
+	/// Append the world coordinates of every tile of the given feature_type inside the rectangle (inclusive) on
+	/// the current floor to the list, from the feature bitsets of the chunks we have loaded.
+	void find_features(int f, int64_t x1, int64_t y1, int64_t x2, int64_t y2, std::vector<coords>& out) const;
 
 private:
-	const chunk* get_chunk_at(int world_x, int world_y) const;
-	chunk* get_chunk_at(int world_x, int world_y);
+	void load_chunks(int64_t x, int64_t y);
+	void pack_chunks(int64_t x1, int64_t y1, int64_t x2, int64_t y2);
+	void release_chunk(coords cc);
+	void prefetch_stairs(int64_t cx, int64_t cy);
+	void process_seams(int64_t x1, int64_t y1, int64_t x2, int64_t y2);
+	void refresh_tiles(int64_t x1, int64_t y1, int64_t x2, int64_t y2);
+	void note_change(int64_t world_x, int64_t world_y);
+	bool in_level(int64_t world_x, int64_t world_y) const;
+	void index_entities(coords cc);
+	void unindex_entities(coords cc);
+	chunk* refind(coords c) const;
+	void update_viewport();
+	void fill_viewport(int x1, int y1, int x2, int y2);
+	const chunk* get_chunk_at(int64_t world_x, int64_t world_y) const;
+	chunk* get_chunk_at(int64_t world_x, int64_t world_y);
+
+	std::unique_ptr<chunkcache> _owned_cache; // only if we were not given a shared cache; must outlive our pins
+	chunkcache* _cache = nullptr;
 
-	/// Chunk data
-	std::unordered_map<coords, chunk> chunks;
+	/// Chunk data, pinned in the cache for as long as we hold them. Mutable since packed chunks are pinned
+	/// again on access.
+	mutable std::unordered_map<coords, chunkpin> chunks;
 
 	int _width = -1;
 	int _height = -1;
-	int _current_x = -1;
-	int _current_y = -1;
+	int64_t _current_x = -1;
+	int64_t _current_y = -1;
 	int _chunk_width = -1;
 	int _chunk_height = -1;
-	int _chunk_x_start = 0;
-	int _chunk_x_end = -1;
-	int _chunk_y_start = 0;
-	int _chunk_y_end = -1;
+	int64_t _chunk_x_start = 0;
+	int64_t _chunk_x_end = -1;
+	int64_t _chunk_y_start = 0;
+	int64_t _chunk_y_end = -1;
+	int _skeleton_margin = 0;
+	int _rooms_margin = 0;
+	int _pack_margin = -1;
+	int _floor = 0;
+	bool _seams = false;
+	bool _positioned = false;
+	chunkview_changes _changes;
+	std::vector<uint8_t> _viewport; // tiles in view, row by row
+	int64_t _viewport_x = 0; // world coordinates of its top left tile
+	int64_t _viewport_y = 0;
+	bool _viewport_valid = false;
+
+	/// Entities of the chunks in view, by grid cells of ENTITY_CELL by ENTITY_CELL tiles, and by chunk and room.
+	/// A chunk is in the second map exactly when its entities are in the grid.
+	enum { ENTITY_CELL = 16 };
+	std::unordered_map<coords, std::vector<chunkview_entity>> _entity_grid;
+	std::unordered_map<coords, std::vector<std::vector<chunkview_entity>>> _room_entities;
 
 	chunkconfig _config;
 };
@@ -1,12 +1,77 @@
 
 #include "chunky.h"
+#include "chunkrender.h"
+
+#include <string.h>
+#include <atomic>
+#include <string>
 
 static bool debug = false;
 
+static const char* stage_names[STAGE_COUNT] =
+{
+	"generate_exits",
+	"chunk_filter_connect_exits",
+	"chunk_filter_connect_exits_inner_loop",
+	"chunk_filter_connect_exits_grand_central",
+	"chunk_filter_room_expand",
+	"chunk_filter_room_in_room",
+	"chunk_filter_one_way_doors",
+	"beautify",
+	"chunk_filter_boss_placement",
+	"chunk_filter_protect_room",
+	"chunk_filter_wildlife",
+	"chunk_filter_chest",
+	"chunk_filter_stairs",
+	"chunk_filter_room_expand_max",
+};
+
+const char* chunk_stage_name(int stage)
+{
+	assert(stage >= 0 && stage < STAGE_COUNT);
+	return stage_names[stage];
+}
+
+chunkstats& chunkstats::operator+=(const chunkstats& other)
+{
+	rock_probes += other.rock_probes;
+	can_build_scans += other.can_build_scans;
+	digs += other.digs;
+	rolls += other.rolls;
+	grow_attempts += other.grow_attempts;
+	grow_failures += other.grow_failures;
+	for (int i = 0; i < STAGE_COUNT; i++)
+	{
+		stage_calls[i] += other.stage_calls[i];
+		stage_ns[i] += other.stage_ns[i];
+	}
+	return *this;
+}
+
+void chunkstats::print() const
+{
+	printf("rock probes: %u, can_build scans: %u, digs: %u, rolls: %u, growth attempts: %u (%u failed)\n", rock_probes, can_build_scans, digs, rolls, grow_attempts, grow_failures);
+	for (int i = 0; i < STAGE_COUNT; i++)
+	{
+		if (stage_calls[i]) printf("\t%-42s %4u calls %10.1f us\n", stage_names[i], stage_calls[i], stage_ns[i] / 1000.0);
+	}
+}
+
 chunk::chunk(const chunkconfig& c) : width(c.width), height(c.height), config(c), map(c.width * c.height)
 {
+	static std::atomic<uint64_t> made(0);
+	revision = made.fetch_add(1, std::memory_order_relaxed) << 32; // leaves each chunk 2^32 changes of its own
 	CHUNK_ASSERT(*this, ispow2(width));
 	bits = highestbitset(width);
+	for (auto& f : features) f.assign((width * height + 63) / 64, 0);
+	if (config.z != 0) config.state = config.orig.derive(0, 0, 2 + config.z); // exits use 0 and 1
+}
+
+bool chunkconfig::stairs(int64_t at_x, int64_t at_y, int at_z) const
+{
+	if (at_z < 0 || at_z + 1 >= floors) return false;
+	if (!unbounded && (at_x < 0 || at_y < 0 || at_x >= level_width || at_y >= level_height)) return false;
+	return orig.derive(chunk::fold(at_x), chunk::fold(at_y), -1 - at_z).roll(0, 3) == 0;
 }
 
 void chunk::room_list_self_test() const
@@ -45,6 +110,185 @@ void chunk::self_test() const
 		const room& r = rooms.at(e.room_index);
 		ROOM_ASSERT(*this, r, r.is_inside(e.x, e.y));
 	}
+	for (int i = 0; i < width * height; i++)
+	{
+		for (int j = FEATURE_NONE + 1; j < FEATURE_TYPES; j++) CHUNK_ASSERT(*this, ((features[j - 1][i >> 6] >> (i & 63)) & 1) == (tile_feature(map[i]) == j));
+	}
+}
+
+static inline void hash_value(uint64_t& h, int64_t v)
+{
+	for (int i = 0; i < 8; i++) { h ^= (uint8_t)(v >> (i * 8)); h *= 0x100000001b3ull; } // FNV-1a
+}
+
+uint64_t chunk::hash() const
+{
+	CHUNK_ASSERT(*this, !packed());
+	uint64_t h = 0xcbf29ce484222325ull;
+	hash_value(h, width);
+	hash_value(h, height);
+	hash_value(h, top);
+	hash_value(h, bottom);
+	hash_value(h, left);
+	hash_value(h, right);
+	for (uint8_t t : map) { h ^= t; h *= 0x100000001b3ull; }
+	hash_value(h, rooms.size());
+	for (const room& r : rooms)
+	{
+		hash_value(h, r.x1); hash_value(h, r.y1); hash_value(h, r.x2); hash_value(h, r.y2);
+		hash_value(h, r.top); hash_value(h, r.bottom); hash_value(h, r.left); hash_value(h, r.right);
+		hash_value(h, r.isolation); hash_value(h, r.flags); hash_value(h, r.index);
+	}
+	hash_value(h, entities.size());
+	for (const entity& e : entities)
+	{
+		hash_value(h, e.type); hash_value(h, e.x); hash_value(h, e.y); hash_value(h, e.room_index);
+	}
+	return h;
+}
+
+// Packed runs are one byte of tile in the low five bits and run length minus one in the high three. A run
+// length field of seven means that the next byte holds the run length minus eight.
+bool chunk::pack()
+{
+	CHUNK_ASSERT(*this, !packed() && !journaling());
+	static_assert(TILE_TYPES <= 32, "tiles no longer fit in five bits");
+	packed_map.clear();
+	for (size_t i = 0; i < map.size();)
+	{
+		const uint8_t t = map[i];
+		size_t run = 1;
+		while (run < 263 && i + run < map.size() && map[i + run] == t) run++;
+		if (run < 8) packed_map.push_back(t | ((run - 1) << 5));
+		else { packed_map.push_back(t | (7 << 5)); packed_map.push_back(run - 8); }
+		i += run;
+		if (packed_map.size() >= map.size()) { std::vector<uint8_t>().swap(packed_map); return false; }
+	}
+	packed_map.shrink_to_fit();
+	std::vector<uint8_t>().swap(map);
+	for (auto& f : features) std::vector<uint64_t>().swap(f);
+	return true;
+}
+
+void chunk::unpack()
+{
+	CHUNK_ASSERT(*this, packed());
+	map.resize(width * height);
+	uint8_t* out = map.data();
+	for (size_t i = 0; i < packed_map.size(); i++)
+	{
+		size_t run = (packed_map[i] >> 5) + 1;
+		if (run == 8) run += packed_map[++i];
+		memset(out, packed_map[i - (run >= 8)] & 31, run);
+		out += run;
+	}
+	CHUNK_ASSERT(*this, out == map.data() + map.size());
+	std::vector<uint8_t>().swap(packed_map);
+	build_features();
+}
+
+void chunk::begin()
+{
+	journal_marks.push_back({ journal.size(), rooms, entities, top, bottom, left, right, seams });
+}
+
+void chunk::commit()
+{
+	CHUNK_ASSERT(*this, journaling());
+	journal_marks.pop_back();
+	if (journal_marks.empty()) journal.clear();
+}
+
+void chunk::rollback()
+{
+	CHUNK_ASSERT(*this, journaling() && !packed());
+	journal_mark& m = journal_marks.back();
+	for (size_t k = journal.size(); k-- > m.tiles;)
+	{
+		const int i = journal[k].first;
+		store(i, journal[k].second);
+		update_mip(i & (width - 1), i >> bits);
+	}
+	journal.resize(m.tiles);
+	rooms = std::move(m.rooms);
+	entities = std::move(m.entities);
+	top = m.top;
+	bottom = m.bottom;
+	left = m.left;
+	right = m.right;
+	seams = m.seams;
+	revision++;
+	journal_marks.pop_back();
+}
+
+void chunk::build_features()
+{
+	for (auto& f : features) f.assign((map.size() + 63) / 64, 0);
+	for (size_t i = 0; i < map.size(); i++)
+	{
+		const int f = tile_feature(map[i]);
+		if (f != FEATURE_NONE) features[f - 1][i >> 6] |= 1ull << (i & 63);
+	}
+}
+
+static inline uint8_t mip_flags_of(uint8_t t)
+{
+	switch (t)
+	{
+	case TILE_ROCK: return 0;
+	case TILE_WALL:
+	case TILE_WALL_DAMAGED: return MIP_WALL;
+	case TILE_DOOR_OPEN:
+	case TILE_DOOR_CLOSED:
+	case TILE_ONE_WAY_TOP:
+	case TILE_ONE_WAY_BOTTOM:
+	case TILE_ONE_WAY_LEFT:
+	case TILE_ONE_WAY_RIGHT: return MIP_OPEN | MIP_DOOR;
+	default: return MIP_OPEN;
+	}
+}
+
+void chunk::build_mip()
+{
+	CHUNK_ASSERT(*this, !packed() && width >= (1 << chunkmip::LEVELS) && height >= (1 << chunkmip::LEVELS));
+	mip.width = width;
+	mip.height = height;
+	for (int level = 1; level <= chunkmip::LEVELS; level++) mip.cells[level - 1].assign((width >> level) * (height >> level), 0);
+	std::vector<uint8_t>& first = mip.cells[0];
+	const int w1 = width >> 1;
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* row = map.data() + (y << bits);
+		uint8_t* out = first.data() + (y >> 1) * w1;
+		for (int x = 0; x < width; x++) out[x >> 1] |= mip_flags_of(row[x]);
+	}
+	for (int level = 2; level <= chunkmip::LEVELS; level++)
+	{
+		const std::vector<uint8_t>& below = mip.cells[level - 2];
+		std::vector<uint8_t>& cells = mip.cells[level - 1];
+		const int wb = width >> (level - 1);
+		const int w = width >> level;
+		for (int y = 0; y < (height >> (level - 1)); y++) for (int x = 0; x < wb; x++) cells[(y >> 1) * w + (x >> 1)] |= below[y * wb + x];
+	}
+}
+
+void chunk::update_mip(int x, int y)
+{
+	if (!mip.built()) return;
+	// The first level from the tiles, the others from the level below, two by two
+	x &= ~1;
+	y &= ~1;
+	uint8_t flags = mip_flags_of(at(x, y)) | mip_flags_of(at(x + 1, y)) | mip_flags_of(at(x, y + 1)) | mip_flags_of(at(x + 1, y + 1));
+	mip.cells[0][(y >> 1) * (width >> 1) + (x >> 1)] = flags;
+	for (int level = 2; level <= chunkmip::LEVELS; level++)
+	{
+		const std::vector<uint8_t>& below = mip.cells[level - 2];
+		const int wb = width >> (level - 1);
+		const int bx = (x >> (level - 1)) & ~1;
+		const int by = (y >> (level - 1)) & ~1;
+		flags = below[by * wb + bx] | below[by * wb + bx + 1] | below[(by + 1) * wb + bx] | below[(by + 1) * wb + bx + 1];
+		mip.cells[level - 1][(y >> level) * (width >> level) + (x >> level)] = flags;
+	}
 }
 
 void room::self_test() const
@@ -60,6 +304,7 @@ void room::self_test() const
 
 void chunk::beautify()
 {
+	CHUNK_STAGE(*this, STAGE_BEAUTIFY);
 	// If surrounded by walls, make sure we're rock
 	for (int xx = 2; xx < width - 2; xx++)
 	{
@@ -82,6 +327,7 @@ void chunk::beautify()
 static bool can_build(const chunk& c, int x1, int y1, int x2, int y2)
 {
 	CHUNK_ASSERT(c, x2 >= x1 && y2 >= y1); // room must be valid
+	CHUNK_STAT(c, can_build_scans);
 	if (x1 < 1 || y1 < 1 || x2 >= c.width - 1 || y2 >= c.height - 1) return false;
 	for (int xx = x1 - 1; xx <= x2 + 1; xx++)
 		for (int yy = y1 - 1; yy <= y2 + 1; yy++)
@@ -96,8 +342,9 @@ static bool can_build(const chunk& c, const room& r)
 
 static bool try_grow_left(chunk& c, room& r)
 {
-	if (r.y1 == 0 || r.y2 == c.height - 1 || r.x1 <= 1) return false;
-	for (int i = r.y1 - 1; i <= r.y2 + 1; i++) if (i != r.left && (!c.rock(r.x1 - 1, i) || !c.rock(r.x1 - 2, i))) return false;
+	CHUNK_STAT(c, grow_attempts);
+	if (r.y1 == 0 || r.y2 == c.height - 1 || r.x1 <= 1) { CHUNK_STAT(c, grow_failures); return false; }
+	for (int i = r.y1 - 1; i <= r.y2 + 1; i++) if (i != r.left && (!c.rock(r.x1 - 1, i) || !c.rock(r.x1 - 2, i))) { CHUNK_STAT(c, grow_failures); return false; }
 	for (int i = r.y1; i <= r.y2; i++) c.dig(r.x1 - 1, i);
 	r.x1--;
 	return true;
@@ -105,8 +352,9 @@ static bool try_grow_left(chunk& c, room& r)
 
 static bool try_grow_right(chunk& c, room& r)
 {
-	if (r.y1 == 0 || r.y2 >= c.height - 1 || r.x2 >= c.width - 2) return false;
-	for (int i = r.y1 - 1; i <= r.y2 + 1; i++) if (i != r.right && (!c.rock(r.x2 + 1, i) || !c.rock(r.x2 + 2, i))) return false;
+	CHUNK_STAT(c, grow_attempts);
+	if (r.y1 == 0 || r.y2 >= c.height - 1 || r.x2 >= c.width - 2) { CHUNK_STAT(c, grow_failures); return false; }
+	for (int i = r.y1 - 1; i <= r.y2 + 1; i++) if (i != r.right && (!c.rock(r.x2 + 1, i) || !c.rock(r.x2 + 2, i))) { CHUNK_STAT(c, grow_failures); return false; }
 	for (int i = r.y1; i <= r.y2; i++) c.dig(r.x2 + 1, i);
 	r.x2++;
 	return true;
@@ -114,8 +362,9 @@ static bool try_grow_right(chunk& c, room& r)
 
 static bool try_grow_top(chunk& c, room& r)
 {
-	if (r.x1 == 0 || r.x2 >= c.width - 1 || r.y1 <= 1) return false;
-	for (int i = r.x1 - 1; i <= r.x2 + 1; i++) if (i != r.top && (!c.rock(i, r.y1 - 1) || !c.rock(i, r.y1 - 2))) return false;
+	CHUNK_STAT(c, grow_attempts);
+	if (r.x1 == 0 || r.x2 >= c.width - 1 || r.y1 <= 1) { CHUNK_STAT(c, grow_failures); return false; }
+	for (int i = r.x1 - 1; i <= r.x2 + 1; i++) if (i != r.top && (!c.rock(i, r.y1 - 1) || !c.rock(i, r.y1 - 2))) { CHUNK_STAT(c, grow_failures); return false; }
 	for (int i = r.x1; i <= r.x2; i++) c.dig(i, r.y1 - 1);
 	r.y1--;
 	return true;
@@ -123,8 +372,9 @@ static bool try_grow_top(chunk& c, room& r)
 
 static bool try_grow_bottom(chunk& c, room& r)
 {
-	if (r.x1 == 0 || r.x2 >= c.width - 1 || r.y2 >= c.height - 2) return false;
-	for (int i = r.x1 - 1; i <= r.x2 + 1; i++) if (i != r.bottom && (!c.rock(i, r.y2 + 1) || !c.rock(i, r.y2 + 2))) return false;
+	CHUNK_STAT(c, grow_attempts);
+	if (r.x1 == 0 || r.x2 >= c.width - 1 || r.y2 >= c.height - 2) { CHUNK_STAT(c, grow_failures); return false; }
+	for (int i = r.x1 - 1; i <= r.x2 + 1; i++) if (i != r.bottom && (!c.rock(i, r.y2 + 1) || !c.rock(i, r.y2 + 2))) { CHUNK_STAT(c, grow_failures); return false; }
 	for (int i = r.x1; i <= r.x2; i++) c.dig(i, r.y2 + 1);
 	r.y2++;
 	return true;
@@ -300,6 +550,7 @@ static void maybe_dig_right_to_exit(chunk& c, room& r)
 
 bool chunk_filter_connect_exits_inner_loop(chunk& c)
 {
+	CHUNK_STAGE(c, STAGE_CONNECT_EXITS_INNER_LOOP);
 	CHUNK_ASSERT(c, c.rooms.size() == 0); // must be first room
 	const int hmid = c.width / 2;
 	const int vmid = c.height / 2;
@@ -340,6 +591,7 @@ bool chunk_filter_connect_exits_inner_loop(chunk& c)
 
 bool chunk_filter_connect_exits_grand_central(chunk& c)
 {
+	CHUNK_STAGE(c, STAGE_CONNECT_EXITS_GRAND_CENTRAL);
 	CHUNK_ASSERT(c, c.rooms.size() == 0); // must be first room
 	const int hmid = c.width / 2;
 	const int vmid = c.height / 2;
@@ -382,6 +634,7 @@ bool chunk_filter_connect_exits_grand_central(chunk& c)
 
 void chunk_filter_connect_exits(chunk& c)
 {
+	CHUNK_STAGE(c, STAGE_CONNECT_EXITS);
 	CHUNK_ASSERT(c, c.rooms.size() == 0);
 	int j;
 
@@ -446,92 +699,33 @@ void chunk_filter_connect_exits(chunk& c)
 	CHUNK_ASSERT(c, c.rooms.size() > 0);
 }
 
-#define DBLACK "\e[0;30m"
-#define DRED "\e[0;31m"
-#define DGREEN "\e[0;32m"
-#define DYELLOW "\e[0;33m"
-#define DBLUE "\e[0;34m"
-#define DPINK "\e[0;35m"
-#define DCYAN "\e[0;36m"
-#define DGRAY "\e[0;37m"
-#define LGRAY "\e[0;90m"
-#define LRED "\e[0;91m"
-#define LGREEN "\e[0;92m"
-#define LYELLOW "\e[0;93m"
-#define LBLUE "\e[0;94m"
-#define LPINK "\e[0;95m"
-#define LCYAN "\e[0;96m"
-#define LWHITE "\e[0;97m"
-static inline void print_tile(uint8_t t)
-{
-	switch (t)
-	{
-	case TILE_ROCK: printf(" "); break;
-	case TILE_WALL: printf("#"); break;
-	case TILE_DOOR_CLOSED: printf(DCYAN"+"); break;
-	case TILE_DOOR_OPEN: printf(DCYAN"'"); break;
-	case TILE_ONE_WAY_TOP: printf(DCYAN"^"); break;
-	case TILE_ONE_WAY_BOTTOM: printf(DCYAN"_"); break;
-	case TILE_ONE_WAY_RIGHT: printf(DCYAN"]"); break;
-	case TILE_ONE_WAY_LEFT: printf(DCYAN"["); break;
-	case TILE_EMPTY: printf("."); break;
-	case TILE_WALL_DAMAGED: printf(LGRAY"#"); break;
-	case TILE_DEBRIS: printf(LGRAY"*"); break;
-	case TILE_RAIL: printf(DBLUE"."); break;
-	case TILE_SENTINEL: printf(LRED"§"); break;
-	case TILE_TURRET: printf(LRED"¤"); break;
-	case TILE_TOTEM: printf(LRED"I"); break;
-	case TILE_TRAP: printf(LRED"~"); break;
-	case TILE_CHEST: printf(LYELLOW"&"); break;
-	case TILE_ALTAR: printf(LBLUE"A"); break;
-	case TILE_SHRINE: printf(LBLUE"S"); break;
-	case TILE_HIDDEN_GROVE: printf(LBLUE"G"); break;
-	case TILE_SHRUB: printf(DGREEN"t"); break;
-
-	case ENTITY_BOSS: printf(LRED"B"); break;
-	case ENTITY_LEADER: printf(LRED"L"); break;
-	case ENTITY_SUPPORT: printf(LGREEN"s"); break;
-	case ENTITY_TANK: printf(LBLUE"T"); break;
-	case ENTITY_DAMAGE: printf("d"); break;
-	case ENTITY_SPECIALIST: printf(LCYAN"S"); break;
-	case ENTITY_WILD: printf(DYELLOW"w"); break;
-	default: assert(false); break;
-	}
-	printf("\x1b[0m");
-}
-
 void chunk::print_chunk() const
 {
 	printf("Chunk (seed=%llu, width=%d, height=%d) (top=%d, right=%d, bottom=%d, left=%d)\n", (unsigned long long)config.state.state, width, height, top, right, bottom, left);
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			print_tile(at(x, y));
-		}
-		printf("\n");
-	}
-	printf("\n");
+	std::string out;
+	chunk_render(out, *this, RENDER_ANSI);
+	out.push_back('\n');
+	fwrite(out.data(), 1, out.size(), stdout);
 }
 
 void print_room(const chunk& c, const room& r)
 {
+	std::string out;
+	char info[128];
 	for (int y = 0; y < c.height; y++)
 	{
-		for (int x = 0; x < c.width; x++)
-		{
-			int t = c.at(x, y);
-			if (t == TILE_EMPTY && x >= r.x1 && x <= r.x2 && y >= r.y1 && y <= r.y2) printf(DYELLOW);
-			print_tile(t);
-		}
-		if (y == 0) printf("\tSize: %d", r.size());
-		else if (y == 1) printf("\tIsolation: %d", r.isolation);
-		else if (y == 2) printf("\tArea: (%d, %d), (%d, %d)", r.x1, r.y1, r.x2, r.y2);
-		else if (y == 3) printf("\tExits: top=%d, right=%d, bottom=%d, left=%d", r.top, r.right, r.bottom, r.left);
-		else if (y == 4) printf("\tFlags: %d", r.flags);
-		printf("\n");
+		chunk_render_row(out, c, y, RENDER_ANSI, &r);
+		int len = 0;
+		if (y == 0) len = snprintf(info, sizeof(info), "\tSize: %d", r.size());
+		else if (y == 1) len = snprintf(info, sizeof(info), "\tIsolation: %d", r.isolation);
+		else if (y == 2) len = snprintf(info, sizeof(info), "\tArea: (%d, %d), (%d, %d)", r.x1, r.y1, r.x2, r.y2);
+		else if (y == 3) len = snprintf(info, sizeof(info), "\tExits: top=%d, right=%d, bottom=%d, left=%d", r.top, r.right, r.bottom, r.left);
+		else if (y == 4) len = snprintf(info, sizeof(info), "\tFlags: %d", r.flags);
+		out.append(info, len);
+		out.push_back('\n');
 	}
-        printf("\n");
+	out.push_back('\n');
+	fwrite(out.data(), 1, out.size(), stdout);
 }
 void print_room(const chunk& c, int roomidx)
 {
@@ -607,6 +801,7 @@ static int room_neighbours(const room& r1, const room& r2)
 
 void chunk_filter_one_way_doors(chunk& c, int threshold)
 {
+	CHUNK_STAGE(c, STAGE_ONE_WAY_DOORS);
 	for (room& r : c.rooms)
 	{
 		for (room& r2 : c.rooms)
@@ -631,6 +826,7 @@ void chunk_filter_one_way_doors(chunk& c, int threshold)
 
 void chunk_filter_room_expand(chunk& c, int min, int max)
 {
+	CHUNK_STAGE(c, STAGE_ROOM_EXPAND);
 	for (int idx = 0; idx < (int)c.rooms.size(); idx++)
 	{
 		const room rc = c.rooms.at(idx);
@@ -699,17 +895,122 @@ void chunk_filter_room_expand(chunk& c, int min, int max)
 	}
 }
 
+// Where room tiles could go: one byte per tile, set if the tile and everything around it is rock, so that a room there
+// gets walls without touching anything open.
+static std::vector<uint8_t> room_space(const chunk& c)
+{
+	const int w = c.width;
+	std::vector<uint8_t> rock(w * c.height);
+	for (int y = 0; y < c.height; y++) for (int x = 0; x < w; x++) rock[y * w + x] = c.rock(x, y);
+	std::vector<uint8_t> space(w * c.height, 0);
+	for (int y = 1; y < c.height - 1; y++)
+	{
+		for (int x = 1; x < w - 1; x++)
+		{
+			const uint8_t* above = &rock[(y - 1) * w + x - 1];
+			const uint8_t* row = above + w;
+			const uint8_t* below = row + w;
+			space[y * w + x] = above[0] & above[1] & above[2] & row[0] & row[1] & row[2] & below[0] & below[1] & below[2];
+		}
+	}
+	return space;
+}
+
+// Try to add a room on the given side of room 'idx', through a door in the middle of its wall at 'ndir'. The room is the
+// largest rectangle of room space next to the door, no larger than the target size.
+static bool expand_max(chunk& c, std::vector<uint8_t>& space, int idx, int side, int ndir, int min, int max)
+{
+	const room rc = c.rooms.at(idx);
+	const bool horizontal = (side == DIR_LEFT || side == DIR_RIGHT);
+	const int extent = horizontal ? c.height : c.width; // along the wall
+	const int edge = (side == DIR_LEFT) ? rc.x1 - 2 : (side == DIR_RIGHT) ? rc.x2 + 2 : (side == DIR_UP) ? rc.y1 - 2 : rc.y2 + 2;
+	const int step = (side == DIR_LEFT || side == DIR_UP) ? -1 : 1;
+	auto free_at = [&](int along, int d) { const int a = edge + d * step; if (a < 0 || a >= (horizontal ? c.width : c.height)) return false; return space[horizontal ? along * c.width + a : a * c.width + along] != 0; };
+
+	// Target size, as if a 3x3 room had grown that many times
+	const int iter = c.roll(min, max);
+	const int deep = 3 + c.roll(0, iter);
+	const int wide = 3 + iter - (deep - 3);
+
+	// How deep the room space goes from each tile along the wall, then the best window of rows around the door
+	const int lo = std::max(1, ndir - wide + 1);
+	const int hi = std::min(extent - 2, ndir + wide - 1);
+	std::vector<int> depth(hi - lo + 1, 0);
+	for (int along = lo; along <= hi; along++) { int d = 0; while (d < deep && free_at(along, d)) d++; depth[along - lo] = d; }
+	int best = 0;
+	int a1 = 0, a2 = 0, bd = 0;
+	const bool neat = (rc.flags & ROOM_FLAG_NEAT);
+	for (int from = neat ? (horizontal ? rc.y1 : rc.x1) : std::max(lo, ndir - wide + 1); from <= ndir && from >= lo; from++)
+	{
+		int d = deep;
+		for (int to = from; to <= hi && to - from < wide; to++)
+		{
+			d = std::min(d, depth[to - lo]);
+			if (d < 3) break;
+			if (neat && to != (horizontal ? rc.y2 : rc.x2)) continue;
+			if (to < ndir || to - from < 2) continue;
+			if (d * (to - from + 1) > best) { best = d * (to - from + 1); a1 = from; a2 = to; bd = d; }
+		}
+		if (neat) break;
+	}
+	if (best == 0) return false;
+
+	const int far = edge + (bd - 1) * step;
+	room nr = horizontal ? room(std::min(edge, far), a1, std::max(edge, far), a2, rc.isolation + 1) : room(a1, std::min(edge, far), a2, std::max(edge, far), rc.isolation + 1);
+	room& r = c.rooms.at(idx);
+	int dx = 0, dy = 0;
+	switch (side)
+	{
+	case DIR_LEFT: r.left = nr.right = ndir; dx = r.x1 - 1; dy = ndir; break;
+	case DIR_RIGHT: r.right = nr.left = ndir; dx = r.x2 + 1; dy = ndir; break;
+	case DIR_UP: r.top = nr.bottom = ndir; dx = ndir; dy = r.y1 - 1; break;
+	case DIR_DOWN: r.bottom = nr.top = ndir; dx = ndir; dy = r.y2 + 1; break;
+	}
+	c.dig(dx, dy); // dig a corridor
+	if (c.roll(0, c.config.openness * 3) == 0) c.build(dx, dy, TILE_DOOR_CLOSED);
+	c.dig_room(nr);
+	c.add_room(nr);
+	if (debug) print_room(c, nr);
+
+	// Nothing next to the new room or its door can take room tiles anymore
+	for (int y = std::max(0, std::min<int>(nr.y1, dy) - 1); y <= std::min(c.height - 1, std::max<int>(nr.y2, dy) + 1); y++)
+	{
+		for (int x = std::max(0, std::min<int>(nr.x1, dx) - 1); x <= std::min(c.width - 1, std::max<int>(nr.x2, dx) + 1); x++) space[y * c.width + x] = 0;
+	}
+	return true;
+}
+
+void chunk_filter_room_expand_max(chunk& c, int min, int max)
+{
+	CHUNK_STAGE(c, STAGE_ROOM_EXPAND_MAX);
+	std::vector<uint8_t> space = room_space(c);
+	for (int idx = 0; idx < (int)c.rooms.size(); idx++)
+	{
+		const room rc = c.rooms.at(idx);
+		rc.self_test();
+		if (rc.left == -1) expand_max(c, space, idx, DIR_LEFT, c.roll(rc.y1, rc.y2), min, max);
+		if (rc.right == -1) expand_max(c, space, idx, DIR_RIGHT, c.roll(rc.y1, rc.y2), min, max);
+		if (rc.top == -1) expand_max(c, space, idx, DIR_UP, c.roll(rc.x1, rc.x2), min, max);
+		if (rc.bottom == -1) expand_max(c, space, idx, DIR_DOWN, c.roll(rc.x1, rc.x2), min, max);
+	}
+}
+
+static void furnish_room(chunk& c, room& r)
+{
+	if (r.flags & ROOM_FLAG_FURNISHED) return;
+	bool large = (r.x2 - r.x1 > 8 && r.y2 - r.y1 > 8);
+	if (c.roll(0, 2) == 0) return; // 33% chance to leave it alone
+	if (c.roll(0, 1) == 0 && chunk_room_in_room(c, r, c.roll(1, large ? 2 : 1))) return;
+	if (chunk_room_corners(c, r, c.roll(CHUNK_TOP_LEFT, CHUNK_TOP_LEFT | CHUNK_TOP_RIGHT | CHUNK_BOTTOM_LEFT | CHUNK_BOTTOM_RIGHT), c.roll(9, 16))) return;
+	r.self_test();
+}
+
 void chunk_filter_room_in_room(chunk& c)
 {
+	CHUNK_STAGE(c, STAGE_ROOM_IN_ROOM);
 	for (unsigned i = 0; i < c.rooms.size(); i++)
 	{
-		room& r = c.rooms.at(i);
-		if (r.flags & ROOM_FLAG_FURNISHED) continue;
-		bool large = (r.x2 - r.x1 > 8 && r.y2 - r.y1 > 8);
-		if (c.roll(0, 2) == 0) continue; // 33% chance to leave it alone
-		if (c.roll(0, 1) == 0 && chunk_room_in_room(c, r, c.roll(1, large ? 2 : 1))) continue;
-		if (chunk_room_corners(c, r, c.roll(CHUNK_TOP_LEFT, CHUNK_TOP_LEFT | CHUNK_TOP_RIGHT | CHUNK_BOTTOM_LEFT | CHUNK_BOTTOM_RIGHT), c.roll(9, 16))) continue;
-		r.self_test();
+		furnish_room(c, c.rooms.at(i));
 	}
 }
 
@@ -872,6 +1173,7 @@ static int room_exit_guards(chunk& c, room& r, tile_type entity)
 
 room& chunk_filter_boss_placement(chunk& c, int flags)
 {
+	CHUNK_STAGE(c, STAGE_BOSS_PLACEMENT);
 	room* rp = &c.rooms[0];
 	for (room& r : c.rooms)
 	{
@@ -939,6 +1241,7 @@ static int populate_room(chunk& c, room& r, int count, tile_type entity, seed& s
 
 bool chunk_filter_protect_room(chunk& c, room& r)
 {
+	CHUNK_STAGE(c, STAGE_PROTECT_ROOM);
 	room* rr = nullptr;
 	seed s = c.config.state;
 	if (r.top != -1 && (rr = find_room_by_exit(c, &r, r.top, r.y1 - 1))) populate_room(c, *rr, s.roll(1, 4), ENTITY_DAMAGE, s);
@@ -950,6 +1253,7 @@ bool chunk_filter_protect_room(chunk& c, room& r)
 
 bool chunk_filter_wildlife(chunk& c)
 {
+	CHUNK_STAGE(c, STAGE_WILDLIFE);
 	seed s = c.config.state;
 	for (room& r : c.rooms)
 	{
@@ -960,6 +1264,7 @@ bool chunk_filter_wildlife(chunk& c)
 
 bool chunk_filter_chest(chunk& c)
 {
+	CHUNK_STAGE(c, STAGE_CHEST);
 	room* rr = nullptr;
 	for (room& r : c.rooms)
 	{
@@ -979,3 +1284,140 @@ bool chunk_filter_chest(chunk& c)
 	rr->flags |= ROOM_FLAG_FURNISHED;
 	return true;
 }
+
+bool chunk_filter_stairs(chunk& c)
+{
+	CHUNK_STAGE(c, STAGE_STAIRS);
+	const bool down = c.config.stairs(c.config.x, c.config.y, c.config.z);
+	const bool up = c.config.stairs(c.config.x, c.config.y, c.config.z - 1);
+	if (!down && !up) return false;
+
+	// Roll from a seed of our own, so that the rest of the chunk does not depend on the stairs
+	seed s = c.config.state.derive(0, 0, 0);
+	std::vector<room*> candidates;
+	for (room& r : c.rooms) if (!(r.flags & ROOM_FLAG_CORRIDOR)) candidates.push_back(&r);
+	if (candidates.empty()) for (room& r : c.rooms) candidates.push_back(&r);
+	bool placed = true;
+	for (int i = 0; i < 2; i++)
+	{
+		if ((i == 0 && !down) || (i == 1 && !up)) continue;
+		const tile_type t = (i == 0) ? TILE_STAIRS_DOWN : TILE_STAIRS_UP;
+		const int first = s.roll(0, candidates.size() - 1);
+		bool done = false;
+		for (unsigned j = 0; j < candidates.size() && !done; j++)
+		{
+			room& r = *candidates[(first + j) % candidates.size()];
+			int x;
+			int y;
+			done = find_location(c, r, x, y, s) && c.try_entity(r, x, y, t);
+		}
+		placed = placed && done;
+	}
+	return placed;
+}
+
+int chunk_filter_seam(chunk& first, chunk& second, int dir, int band)
+{
+	CHUNK_ASSERT(first, dir == DIR_RIGHT || dir == DIR_DOWN);
+	CHUNK_ASSERT(first, first.width == second.width && first.height == second.height);
+	const bool across = (dir == DIR_RIGHT);
+	const int length = across ? first.height : first.width; // along the seam
+	const int size = across ? first.width : first.height; // across it, per chunk
+	band = std::min(band, size / 2 - 1);
+
+	// Position 'a' counts across the seam, negative in the first chunk; 'l' counts along it
+	auto chunk_for = [&](int a) -> chunk& { return (a < 0) ? first : second; };
+	auto inner = [&](int a) { return (a < 0) ? size + a : a; };
+	auto solid = [&](int a, int l) { const int k = inner(a); const uint8_t t = across ? chunk_for(a).at(k, l) : chunk_for(a).at(l, k); return t == TILE_WALL || t == TILE_ROCK; };
+
+	// Decide everything before changing anything, so that the result does not depend on the order
+	std::vector<std::pair<int, int>> fills;
+	for (int a = -band; a < band; a++)
+	{
+		for (int l = 1; l < length - 1; l++) // the ends touch chunks we cannot see
+		{
+			bool allwall = true;
+			for (int i = -1; i <= 1 && allwall; i++) for (int j = -1; j <= 1 && allwall; j++) allwall = solid(a + i, l + j);
+			const int k = inner(a);
+			if (allwall && (across ? chunk_for(a).at(k, l) : chunk_for(a).at(l, k)) == TILE_WALL) fills.push_back({ a, l });
+		}
+	}
+	for (const auto& f : fills)
+	{
+		const int k = inner(f.first);
+		const int x = across ? k : f.second;
+		const int y = across ? f.second : k;
+		chunk_for(f.first).fill(x, y);
+		chunk_for(f.first).update_mip(x, y);
+	}
+	first.seams |= dir;
+	second.seams |= across ? DIR_LEFT : DIR_UP;
+	return fills.size();
+}
+
+// Entities that other parts of the world rely on: stairs link floors, and there is one boss and one chest per chunk
+static inline bool anchored(const entity& e)
+{
+	return e.type == TILE_STAIRS_UP || e.type == TILE_STAIRS_DOWN || e.type == TILE_CHEST || e.type == ENTITY_BOSS;
+}
+
+bool chunk_room_reroll(chunk& c, int room_index, seed s)
+{
+	room& r = c.rooms.at(room_index);
+	if (r.flags & (ROOM_FLAG_CORRIDOR | ROOM_FLAG_NESTED)) return false;
+
+	// Forget the rooms nested in it and everything standing in it, keeping the order of the rest
+	std::vector<int> remap(c.rooms.size());
+	int kept = 0;
+	for (unsigned i = 0; i < c.rooms.size(); i++)
+	{
+		const room& o = c.rooms[i];
+		const bool inside = (o.flags & ROOM_FLAG_NESTED) && o.x1 >= r.x1 && o.x2 <= r.x2 && o.y1 >= r.y1 && o.y2 <= r.y2;
+		remap[i] = inside ? -1 : kept++;
+	}
+	for (const entity& e : c.entities) if (anchored(e) && (r.is_inside(e.x, e.y) || remap[e.room_index] == -1)) return false;
+	c.entities.erase(std::remove_if(c.entities.begin(), c.entities.end(), [&](const entity& e) { return r.is_inside(e.x, e.y) || remap[e.room_index] == -1; }), c.entities.end());
+	for (entity& e : c.entities) e.room_index = remap[e.room_index];
+	if (kept < (int)c.rooms.size())
+	{
+		std::deque<room> rooms;
+		for (room& o : c.rooms) if (remap[o.index] != -1) { o.index = remap[o.index]; rooms.push_back(o); }
+		c.rooms.swap(rooms);
+	}
+	room& target = c.rooms.at(remap[room_index]);
+	for (int y = target.y1; y <= target.y2; y++) for (int x = target.x1; x <= target.x2; x++) if (c.at(x, y) != TILE_EMPTY) c.build(x, y, TILE_EMPTY);
+	target.flags &= ~ROOM_FLAG_FURNISHED;
+
+	// Roll it again like chunk_filter_room_in_room() and chunk_filter_wildlife() do, from the given seed only
+	const seed saved = c.config.state;
+	c.config.state = s;
+	const unsigned first_new = c.rooms.size();
+	furnish_room(c, target);
+	seed p = s.derive(0, 0, 1);
+	populate_room(c, target, p.quadratic_weighted_roll(3) + 1, ENTITY_WILD, p);
+	for (unsigned i = first_new; i < c.rooms.size(); i++) populate_room(c, c.rooms[i], p.quadratic_weighted_roll(3) + 1, ENTITY_WILD, p);
+	c.config.state = saved;
+
+	for (int y = target.y1 & ~1; y <= target.y2; y += 2) for (int x = target.x1 & ~1; x <= target.x2; x += 2) c.update_mip(x, y);
+	c.revision++; // the rooms and entities changed, even where the tiles did not
+	return true;
+}
+
+int chunk_area_reroll(chunk& c, int x1, int y1, int x2, int y2, seed s)
+{
+	// Room indices move as nested rooms go, so find each room again by where it is
+	std::vector<room> targets;
+	for (const room& r : c.rooms)
+	{
+		if (!(r.flags & (ROOM_FLAG_CORRIDOR | ROOM_FLAG_NESTED)) && range_overlap(r.x1, r.x2, x1, x2) && range_overlap(r.y1, r.y2, y1, y2)) targets.push_back(r);
+	}
+	int count = 0;
+	for (const room& t : targets)
+	{
+		for (const room& r : c.rooms)
+		{
+			if (r == t) { count += chunk_room_reroll(c, r.index, s.derive(r.x1, r.y1, 0)); break; }
+		}
+	}
+	return count;
+}
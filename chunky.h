@@ -1,12 +1,16 @@
 #pragma once
 
 #include "external/libdicey/dice.h"
+#include "chunktrace.h"
 #include <assert.h>
 #include <vector>
 #include <deque>
 #include <stdint.h>
 #include <signal.h>
 #include <stdio.h>
+#ifdef CHUNKY_STATS
+#include <chrono>
+#endif
 
 // -- Debug --
 
@@ -29,6 +33,73 @@ void print_room(const chunk& c, const room& r);
 #define ROOM_ASSERT(c, r, expr)
 #endif
 
+// -- Statistics --
+
+/// Generation steps that are timed when statistics are enabled.
+enum chunk_stage
+{
+	STAGE_GENERATE_EXITS,
+	STAGE_CONNECT_EXITS,
+	STAGE_CONNECT_EXITS_INNER_LOOP,
+	STAGE_CONNECT_EXITS_GRAND_CENTRAL,
+	STAGE_ROOM_EXPAND,
+	STAGE_ROOM_IN_ROOM,
+	STAGE_ONE_WAY_DOORS,
+	STAGE_BEAUTIFY,
+	STAGE_BOSS_PLACEMENT,
+	STAGE_PROTECT_ROOM,
+	STAGE_WILDLIFE,
+	STAGE_CHEST,
+	STAGE_STAIRS,
+	STAGE_ROOM_EXPAND_MAX,
+	STAGE_COUNT
+};
+
+/// Name of a generation step, for printing.
+const char* chunk_stage_name(int stage);
+
+/// Hot path counters and stage timers for a chunk. These are only collected when compiled with CHUNKY_STATS
+/// defined (cmake -DCHUNKY_STATS=ON); otherwise the chunk does not even have a stats member. Stage times are
+/// inclusive, so a filter that calls another filter also counts the time spent in it. Stages are also
+/// recorded as trace events whenever tracing is started at runtime. Counting is not thread safe, so nothing is
+/// counted on a chunk while it is marked as shared; the chunkcache marks the chunks it hands out, which means
+/// that their statistics only cover their generation.
+struct chunkstats
+{
+	uint32_t rock_probes = 0;
+	uint32_t can_build_scans = 0;
+	uint32_t digs = 0;
+	uint32_t rolls = 0; // only rolls made through the chunk, not on local copies of the seed
+	uint32_t grow_attempts = 0;
+	uint32_t grow_failures = 0;
+	uint32_t stage_calls[STAGE_COUNT] = {};
+	uint64_t stage_ns[STAGE_COUNT] = {};
+
+	chunkstats& operator+=(const chunkstats& other);
+	void print() const;
+};
+
+#ifdef CHUNKY_STATS
+struct chunkstats_timer
+{
+	chunkstats_timer(chunkstats* s, int stage) : _stats(s), _stage(stage), _start(std::chrono::steady_clock::now()) {}
+	~chunkstats_timer()
+	{
+		if (!_stats) return;
+		_stats->stage_calls[_stage]++;
+		_stats->stage_ns[_stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+	}
+	chunkstats* _stats;
+	int _stage;
+	std::chrono::steady_clock::time_point _start;
+};
+#define CHUNK_STAT(c, counter) ((c).stats_shared ? (void)0 : (void)(c).stats.counter++)
+#define CHUNK_STAGE(c, stage) chunkstats_timer chunk_stage_timer((c).stats_shared ? nullptr : &(c).stats, stage); chunk_trace_scope chunk_stage_trace(stage, &(c))
+#else
+#define CHUNK_STAT(c, counter) ((void)0)
+#define CHUNK_STAGE(c, stage) chunk_trace_scope chunk_stage_trace(stage, &(c)) // see chunktrace.h
+#endif
+
 // -- Constants --
 
 #define DIR_UP 0b1000
@@ -84,6 +155,12 @@ enum tile_type
 	ENTITY_DAMAGE,
 	ENTITY_SPECIALIST,
 	ENTITY_WILD, // random wild mob
+
+	// Stairs are placed like entities; they come last so that older tiles keep their values
+	TILE_STAIRS_UP,
+	TILE_STAIRS_DOWN,
+
+	TILE_TYPES // number of tile types
 };
 
 struct entity
@@ -109,10 +186,17 @@ struct chunkconfig
 	seed orig;
 
 	// Our place in the world (ie level)
-	int x = 0; // our location in the level in chunks units
-	int y = 0;
+	int64_t x = 0; // our location in the level in chunks units
+	int64_t y = 0;
 	int level_width = 32; // width of chunk world in chunks
 	int level_height = 32;
+	bool unbounded = false; // ignore the level size; chunks have neighbours in every direction, at any coordinates
+	int z = 0; // our floor; floors other than the top one roll from their own seed, derived from orig
+	int floors = 1; // number of floors, linked by stairs
+
+	/// Whether chunk (x, y) has stairs between floor z and floor z + 1. Both floors agree on this without
+	/// generating each other.
+	bool stairs(int64_t x, int64_t y, int z) const;
 };
 
 /// Room dimensions are equal to its dug out inner space, not including the walls surrounding it.
@@ -145,13 +229,80 @@ struct room
 inline bool operator==(const room& lhs, const room& rhs){ return (lhs.x1 == rhs.x1 && lhs.y1 == rhs.y1 && lhs.x2 == rhs.x2 && lhs.y2 == rhs.y2); }
 inline bool operator!=(const room& lhs, const room& rhs){ return !(lhs == rhs); }
 
+/// Categories of tiles that chunks keep a bitset index of, so that they can be found without scanning the map.
+enum feature_type
+{
+	FEATURE_NONE,
+	FEATURE_DOOR, // open and closed doors
+	FEATURE_ONE_WAY, // one-way doors
+	FEATURE_WALL,
+	FEATURE_INTERACTABLE, // traps, shrines, chests, stairs and the like
+	FEATURE_ENTITY, // mobs
+	FEATURE_TYPES
+};
+
+inline int tile_feature(uint8_t t)
+{
+	switch (t)
+	{
+	case TILE_DOOR_OPEN:
+	case TILE_DOOR_CLOSED: return FEATURE_DOOR;
+	case TILE_ONE_WAY_TOP:
+	case TILE_ONE_WAY_BOTTOM:
+	case TILE_ONE_WAY_LEFT:
+	case TILE_ONE_WAY_RIGHT: return FEATURE_ONE_WAY;
+	case TILE_WALL:
+	case TILE_WALL_DAMAGED: return FEATURE_WALL;
+	case TILE_SENTINEL:
+	case TILE_TURRET:
+	case TILE_TOTEM:
+	case TILE_TRAP:
+	case TILE_ALTAR:
+	case TILE_SHRINE:
+	case TILE_HIDDEN_GROVE:
+	case TILE_CHEST:
+	case TILE_STAIRS_UP:
+	case TILE_STAIRS_DOWN: return FEATURE_INTERACTABLE;
+	case ENTITY_BOSS:
+	case ENTITY_LEADER:
+	case ENTITY_SUPPORT:
+	case ENTITY_TANK:
+	case ENTITY_DAMAGE:
+	case ENTITY_SPECIALIST:
+	case ENTITY_WILD: return FEATURE_ENTITY;
+	default: return FEATURE_NONE;
+	}
+}
+
+/// What a cell of a chunkmip holds: whether any of the tiles it covers is ...
+enum mip_flags
+{
+	MIP_OPEN = 1, // ... something other than rock and walls
+	MIP_DOOR = 2, // ... a door of any kind
+	MIP_WALL = 4, // ... a wall
+};
+
+/// Downsampled summaries of the tiles of a chunk, for minimaps and coarse queries. Level n has one cell of mip_flags
+/// for each 2^n by 2^n tiles.
+struct chunkmip
+{
+	enum { LEVELS = 3 };
+	std::vector<uint8_t> cells[LEVELS]; // levels 1 to LEVELS, row by row; empty until built
+	int width = 0; // of the chunk, in tiles
+	int height = 0;
+
+	bool built() const { return !cells[0].empty(); }
+	/// Cell of the given level covering tile (x, y)
+	inline uint8_t at(int level, int x, int y) const { return cells[level - 1][(y >> level) * (width >> level) + (x >> level)]; }
+};
+
 /// A small chunk of a level's map. Limitations: It must be power-of-two size in each direction. And it can only have
 /// one exit to the next chunk in each direction (not including stairs, portals, etc.).
 struct chunk
 {
 	chunk(const chunkconfig& c);
 
-	inline void consider_door(int x, int y) { if (config.state.roll(0, config.openness * 2) == 0) build(x, y, TILE_DOOR_CLOSED); else build(x, y, TILE_EMPTY); }
+	inline void consider_door(int x, int y) { if (roll(0, config.openness * 2) == 0) build(x, y, TILE_DOOR_CLOSED); else build(x, y, TILE_EMPTY); }
 	inline void make_exit_top(int v) { top = v; dig(v, 0); consider_door(v, 0); }
 	inline void make_exit_left(int v) { left = v; dig(0, v); consider_door(0, v); }
 	inline void make_exit_bottom(int v) { bottom = v; dig(v, config.height - 1); consider_door(v, config.height - 1); }
@@ -161,10 +312,21 @@ struct chunk
 	/// of the chunk and the total size of the map, both in terms of chunks.
 	void generate_exits()
 	{
-		if (config.y > 0 && top == -1) { make_exit_top(config.state.derive(config.x, config.y - 1, 0).roll(3, config.width - 3)); } // Top
-		if (config.x > 0 && left == -1) { make_exit_left(config.state.derive(config.x - 1, config.y, 1).roll(3, config.height - 3)); } // Left
-		if (config.y < config.level_height - 1 && bottom == -1) { make_exit_bottom(config.state.derive(config.x, config.y, 0).roll(3, config.width - 3)); } // Bottom
-		if (config.x < config.level_width - 1 && right == -1) { make_exit_right(config.state.derive(config.x, config.y, 1).roll(3, config.height - 3)); } // Right
+		CHUNK_STAGE(*this, STAGE_GENERATE_EXITS);
+		const bool open = config.unbounded;
+		if ((open || config.y > 0) && top == -1) { make_exit_top(config.state.derive(fold(config.x), fold(config.y - 1), 0).roll(3, config.width - 3)); } // Top
+		if ((open || config.x > 0) && left == -1) { make_exit_left(config.state.derive(fold(config.x - 1), fold(config.y), 1).roll(3, config.height - 3)); } // Left
+		if ((open || config.y < config.level_height - 1) && bottom == -1) { make_exit_bottom(config.state.derive(fold(config.x), fold(config.y), 0).roll(3, config.width - 3)); } // Bottom
+		if ((open || config.x < config.level_width - 1) && right == -1) { make_exit_right(config.state.derive(fold(config.x), fold(config.y), 1).roll(3, config.height - 3)); } // Right
+	}
+
+	/// Fold a chunk coordinate into the int that seed derivation takes. Coordinates that fit in an int are unchanged,
+	/// so bounded levels look the same as before; larger ones mix in their high bits.
+	static inline int fold(int64_t v)
+	{
+		const int64_t high = v >> 31;
+		if (high == 0 || high == -1) return (int)v;
+		return (int)((uint32_t)v ^ (uint32_t)(((uint64_t)high * 0x9E3779B97F4A7C15ull) >> 32));
 	}
 
 	void add_room(room& r)
@@ -179,7 +341,7 @@ struct chunk
 	/// Excavate a room. The space must be filled with rocks only.
 	void dig_room(const room& r)
 	{
-		for (int x = r.x1; x <= r.x2; x++) { for (int y = r.y1; y <= r.y2; y++) { CHUNK_ASSERT(*this, rock(x, y)); map[(y << bits) + x] = TILE_EMPTY; } }
+		for (int x = r.x1; x <= r.x2; x++) { for (int y = r.y1; y <= r.y2; y++) { CHUNK_ASSERT(*this, rock(x, y)); put((y << bits) + x, TILE_EMPTY); } }
 		for (int x = r.x1 - 1; x <= r.x2 + 1; x++) { if (rock(x, r.y1 - 1)) makewall(x, r.y1 - 1); if (rock(x, r.y2 + 1)) makewall(x, r.y2 + 1); }
 		for (int y = r.y1 - 1; y <= r.y2 + 1; y++) { if (rock(r.x1 - 1, y)) makewall(r.x1 - 1, y); if (rock(r.x2 + 1, y)) makewall(r.x2 + 1, y); }
 		if (r.top > 0) consider_door(r.top, r.y1 - 1);
@@ -202,17 +364,18 @@ struct chunk
 	}
 
 	// Low-level functions
-	inline bool rock(int x, int y) const { const int i = map.at((y << bits) + x); return i == TILE_ROCK || i == TILE_WALL || i == TILE_WALL_DAMAGED; }
+	inline bool rock(int x, int y) const { CHUNK_STAT(*this, rock_probes); const int i = map.at((y << bits) + x); return i == TILE_ROCK || i == TILE_WALL || i == TILE_WALL_DAMAGED; }
 	inline bool empty(int x, int y) const { return (map[(y << bits) + x] == TILE_EMPTY); }
 	inline bool wall(int x, int y) const { const int i = map[(y << bits) + x]; return i == TILE_WALL || i == TILE_WALL_DAMAGED; }
-	inline void fill(int x, int y) { map[(y << bits) + x] = TILE_ROCK; }
-	inline void makewall(int x, int y) { map[(y << bits) + x] = TILE_WALL; }
+	inline void fill(int x, int y) { put((y << bits) + x, TILE_ROCK); }
+	inline void makewall(int x, int y) { put((y << bits) + x, TILE_WALL); }
 	inline uint8_t at(int x, int y) const { return map.at((y << bits) + x); }
+	inline const uint8_t* tiles() const { return map.data(); } // all tiles, row by row
 	inline bool border(int x, int y) const { return (x == 0 || y == 0 || x == width - 1 || y == height -1); }
-	inline void build(int x, int y, tile_type t) { map[(y << bits) + x] = t; }
-	inline bool try_build(int x, int y, tile_type t) { if (empty(x, y)) { map[(y << bits) + x] = t; return true; } else return false; }
-	inline void dig(int x, int y) { map[(y << bits) + x] = TILE_EMPTY; for (int i = std::max(0, x - 1); i <= std::min(width - 1, x + 1); i++) for (int j = std::max(0, y - 1); j <= std::min(height - 1, y + 1); j++) if (rock(i, j)) map[(j << bits) + i] = TILE_WALL; }
-	inline int roll(int low, int high) { return config.state.roll(low, high); } // convenience function
+	inline void build(int x, int y, tile_type t) { put((y << bits) + x, t); }
+	inline bool try_build(int x, int y, tile_type t) { if (empty(x, y)) { put((y << bits) + x, t); return true; } else return false; }
+	inline void dig(int x, int y) { CHUNK_STAT(*this, digs); put((y << bits) + x, TILE_EMPTY); for (int i = std::max(0, x - 1); i <= std::min(width - 1, x + 1); i++) for (int j = std::max(0, y - 1); j <= std::min(height - 1, y + 1); j++) if (rock(i, j)) put((j << bits) + i, TILE_WALL); }
+	inline int roll(int low, int high) { CHUNK_STAT(*this, rolls); return config.state.roll(low, high); } // convenience function
 	void beautify();
 
 	inline int try_entity(const room& r, int x, int y, tile_type t)
@@ -246,18 +409,125 @@ struct chunk
 	int left = -1;
 	int right = -1;
 
+	/// Sides, as DIR_* bits, whose seam with the neighbouring chunk has been post-processed by chunk_filter_seam()
+	int seams = 0;
+
 	void self_test() const;
 	void room_list_self_test() const;
 	void print_chunk() const;
 
+	/// Hash of everything generated: map, exits, rooms and entities. Equal chunks give equal hashes on all platforms.
+	uint64_t hash() const;
+
+	/// Run-length encode the tile map to save memory while nobody needs the chunk. Tiles cannot be accessed
+	/// until the chunk is unpacked again. Rooms and entities are kept as they are. Returns false and leaves
+	/// the chunk alone if packing would not save memory.
+	bool pack();
+	void unpack();
+
+	/// Start recording changes, so that they can be undone by rollback(). Tile changes are journaled one by one
+	/// and undone in time proportional to their number. Rooms, entities, exits and seam flags are not journaled:
+	/// begin() copies them, so each begin() costs time and memory proportional to the number of rooms and
+	/// entities in the chunk, even if the transaction touches none of them. Room records are edited in place by
+	/// many filters, through references the journal could not see, so copying is the only safe way to restore
+	/// them. Keep transactions coarse, e.g. one per filter or reroll rather than one per tile. Transactions
+	/// nest, and each level makes its own copy. Random state is not rolled back, so that a retry rolls anew.
+	void begin();
+	/// Keep the changes made since the matching begin().
+	void commit();
+	/// Undo the changes made since the matching begin().
+	void rollback();
+	bool journaling() const { return !journal_marks.empty(); }
+
+	/// (Re)build the mip pyramid from the tiles. The chunkcache does this whenever it has generated a chunk.
+	void build_mip();
+	/// Bring the mip pyramid up to date after tile (x, y) changed. Does nothing if it was never built.
+	void update_mip(int x, int y);
+	bool packed() const { return map.empty(); }
+
+	/// One bit per tile in map order, set where the tile belongs to the given feature_type. Kept up to date by
+	/// every tile change. Dropped while packed and rebuilt on unpack.
+	const std::vector<uint64_t>& feature_bits(int f) const { return features[f - 1]; }
+	/// Number of tiles of the given feature_type inside the rectangle (inclusive).
+	int count_features(int f, int x1, int y1, int x2, int y2) const { int n = 0; for_each_feature_bits(f, x1, y1, x2, y2, [&n](uint64_t m, int) { n += __builtin_popcountll(m); }); return n; }
+	/// Call fn(x, y) for every tile of the given feature_type inside the rectangle (inclusive), row by row.
+	template<typename F> void for_each_feature(int f, int x1, int y1, int x2, int y2, F fn) const
+	{
+		for_each_feature_bits(f, x1, y1, x2, y2, [&](uint64_t m, int base) { while (m) { const int i = base + __builtin_ctzll(m); fn(i & (width - 1), i >> bits); m &= m - 1; } });
+	}
+	/// Bytes used by the tile map in its current form.
+	size_t map_bytes() const { return packed() ? packed_map.size() : map.size(); }
+
 	chunkconfig config; // TBD some duplication here
+	chunkmip mip;
 
 	std::deque<room> rooms;
 	std::vector<entity> entities;
 
+	/// Changes whenever the tiles change, and on reroll or rollback; bump it when changing rooms or entities
+	/// by hand. Every new chunk starts from a value no other chunk started from, so a chunk that takes the
+	/// place of another is never mistaken for it. Copies keep the value, as they hold the same content.
+	uint64_t revision;
+
+#ifdef CHUNKY_STATS
+	mutable chunkstats stats;
+	bool stats_shared = false; // other threads may read the chunk, so stats are left alone; copies keep this
+#endif
+
 private:
 	unsigned bits; // number of bits to bitshift to move from row to row
 	std::vector<uint8_t> map;
+	std::vector<uint8_t> packed_map; // run-length encoded tiles, while packed
+	std::vector<uint64_t> features[FEATURE_TYPES - 1]; // bitset index per feature_type except FEATURE_NONE
+
+	struct journal_mark
+	{
+		size_t tiles; // journal size at begin()
+		std::deque<room> rooms;
+		std::vector<entity> entities;
+		int top, bottom, left, right, seams;
+	};
+	std::vector<std::pair<int, uint8_t>> journal; // tile index and value before each change, while journaling
+	std::vector<journal_mark> journal_marks; // one per open transaction
+
+	/// All tile changes go through here, to keep the journal and the feature bitsets in step with the map
+	inline void put(int i, uint8_t t)
+	{
+		if (!journal_marks.empty()) journal.emplace_back(i, map[i]);
+		store(i, t);
+	}
+	inline void store(int i, uint8_t t)
+	{
+		const int was = tile_feature(map[i]);
+		const int is = tile_feature(t);
+		map[i] = t;
+		revision++;
+		if (was == is) return;
+		if (was != FEATURE_NONE) features[was - 1][i >> 6] &= ~(1ull << (i & 63));
+		if (is != FEATURE_NONE) features[is - 1][i >> 6] |= 1ull << (i & 63);
+	}
+	void build_features();
+
+	/// Call fn(mask, index of bit 0) for each word of the feature bitset overlapping the rectangle, masked to it
+	template<typename F> void for_each_feature_bits(int f, int x1, int y1, int x2, int y2, F fn) const
+	{
+		CHUNK_ASSERT(*this, !packed() && f > FEATURE_NONE && f < FEATURE_TYPES);
+		const std::vector<uint64_t>& set = features[f - 1];
+		const bool whole_rows = (x1 == 0 && x2 == width - 1);
+		for (int y = y1; y <= y2; y++)
+		{
+			const int first = (y << bits) + x1;
+			const int last = whole_rows ? (y2 << bits) + x2 : (y << bits) + x2; // whole rows are one span
+			for (int w = first >> 6; w <= last >> 6; w++)
+			{
+				uint64_t m = set[w];
+				if (w == first >> 6) m &= ~0ull << (first & 63);
+				if (w == last >> 6) m &= ~0ull >> (63 - (last & 63));
+				if (m) fn(m, w << 6);
+			}
+			if (whole_rows) break;
+		}
+	}
 };
 
 // -- Filters --
@@ -280,6 +550,12 @@ void chunk_filter_one_way_doors(chunk& c, int threshold = 3);
 /// and neat flag if you want rooms to align more neatly.
 void chunk_filter_room_expand(chunk& c, int min = 2, int max = 6);
 
+/// Like chunk_filter_room_expand(), but instead of growing each new room one row or column at a time, find the largest
+/// empty rectangle next to each door up to a rolled target size, from a bitmap of where room tiles can go, and dig
+/// it in one go. 'min' and 'max' bound the target growth as for chunk_filter_room_expand(). Rolls differently, so
+/// gives different chunks than it.
+void chunk_filter_room_expand_max(chunk& c, int min = 2, int max = 6);
+
 /// Find the best room in the chunk for a boss room, and place a boss token in it.
 room& chunk_filter_boss_placement(chunk& c, int flags);
 
@@ -324,3 +600,24 @@ bool chunk_filter_wildlife(chunk& c);
 
 /// A filter to add a single chest in the most isolated room in the chunk.
 bool chunk_filter_chest(chunk& c);
+
+/// Clear one room and roll its furnishing and population again, as chunk_filter_room_in_room() and chunk_filter_wildlife()
+/// would, but from the given seed only, so that the same seed always gives the same room. Rooms nested in it and everything
+/// standing in it are removed first; rooms after those move down in the room list. Only tiles inside the room change.
+/// Corridors and nested rooms cannot be rerolled on their own, nor rooms holding stairs, the chest or the boss, which
+/// the rest of the world relies on; returns false for those.
+bool chunk_room_reroll(chunk& c, int room_index, seed s);
+
+/// Reroll every room overlapping the rectangle, each from a seed derived from the given one and its position.
+/// Returns the number of rooms rerolled; rooms chunk_room_reroll() refuses are left alone.
+int chunk_area_reroll(chunk& c, int x1, int y1, int x2, int y2, seed s);
+
+/// Post-process the seam between two neighbouring chunks: 'second' lies right of 'first' if 'dir' is DIR_RIGHT, or below
+/// it if DIR_DOWN. Within 'band' tiles of the seam on either side, walls with nothing but walls and rock around them,
+/// counting the other chunk, become rock, as beautify() does away from the borders. Marks the seam done in both chunks.
+/// Returns the number of tiles changed.
+int chunk_filter_seam(chunk& first, chunk& second, int dir, int band = 2);
+
+/// Place stairs up and down wherever chunkconfig::stairs() says this chunk has them, as entities in rooms.
+/// Does nothing for single floor levels.
+bool chunk_filter_stairs(chunk& c);
@@ -8,6 +8,8 @@
 #include <time.h>
 #include <ncurses.h>
 
+#include <vector>
+
 static int width = 64;
 static int height = 32;
 static int level_width = 4;
@@ -18,41 +20,33 @@ static int x = 10;
 static int y = 10;
 
 
+static void screen_clear()
+{
+	if (!headless) clear();
+	else offscreen.assign(offscreen.size(), ' ');
+}
+
 static void render_room(const chunk& c)
 {
 	for (int y = 0; y < c.height; y++)
 	{
 		for (int x = 0; x < c.width; x++)
 		{
-			const int t = c.at(x, y);
-			chtype attrs = 0;
-			if (has_colors())
-			{
-				const short pair = tile_color_pair(t);
-				if (pair != 0) attrs |= COLOR_PAIR(pair);
-			}
-			mvaddch(y, x, tile_glyph(t) | attrs);
+			screen_put(y, x, tile_char(c.at(x, y)));
 		}
 	}
-	refresh();
+	screen_refresh();
 }
 
 static void restore(const chunk& c, int y, int x)
 {
-	const uint8_t t = c.at(x, y);
-	chtype attrs = 0;
-	if (has_colors())
-	{
-		const short pair = tile_color_pair(t);
-		if (pair != 0) attrs |= COLOR_PAIR(pair);
-	}
-	mvaddch(y, x, tile_glyph(t) | attrs);
+	screen_put(y, x, tile_char(c.at(x, y)));
 }
 
 static void place_me(const chunk& c, int y, int x)
 {
-	mvaddch(y, x, me);
-	refresh();
+	screen_put(y, x, me);
+	screen_refresh();
 }
 
 static void generate_room(chunk& c, int method)
@@ -94,7 +88,7 @@ static void load_chunk(chunk& c, chunkconfig& config, int new_chunk_x, int new_c
 	config.y = new_chunk_y;
 	c = chunk(config);
 	generate_room(c, 0);
-	clear();
+	screen_clear();
 	render_room(c);
 	x = new_x;
 	y = new_y;
@@ -146,123 +140,162 @@ static bool try_move(chunk& c, int from_x, int from_y, int to_x, int to_y)
 	return false;
 }
 
-int main()
+static void handle_key(chunk& c, chunkconfig& config, int ch)
 {
-	uint64_t value = time(nullptr);
-	seed s(value, value);
-	chunkconfig config(s);
-	config.width = width;
-	config.height = height;
-	config.level_width = level_width;
-	config.level_height = level_height;
-	config.x = chunk_xpos;
-	config.y = chunk_ypos;
-	config.chaos = s.roll(0, 4);
-	config.openness = s.roll(0, 4);
-	chunk c(config);
-	generate_room(c, 0);
-
-	initscr();
-	clear();
-	noecho();
-	cbreak();
-	set_escdelay(25); // avoid annoying ESC handling delay; we won't use ALT keys anyways
-	keypad(stdscr, TRUE);
-	curs_set(0);
-	clear();
-	init_colors_once();
-	render_room(c);
-	int ch = 0;
-	while (1)
+	if (ch == KEY_LEFT && x == 0)
 	{
-		mvaddch(y, x, me);
-		ch = getch();
-		if (ch == 'q' || ch == 'Q' || ch == 27) break;
-		else if (ch == KEY_LEFT && x == 0)
-		{
-			try_switch_chunk(c, config, -1, 0);
-		}
-		else if (ch == KEY_LEFT && try_move(c, x, y, x - 1, y))
+		try_switch_chunk(c, config, -1, 0);
+	}
+	else if (ch == KEY_LEFT && try_move(c, x, y, x - 1, y))
+	{
+		restore(c, y, x);
+		x--;
+		place_me(c, y, x);
+	}
+	else if (ch == KEY_RIGHT && x == c.width - 1)
+	{
+		try_switch_chunk(c, config, 1, 0);
+	}
+	else if (ch == KEY_RIGHT && try_move(c, x, y, x + 1, y))
+	{
+		restore(c, y, x);
+		x++;
+		place_me(c, y, x);
+	}
+	else if (ch == KEY_UP && y == 0)
+	{
+		try_switch_chunk(c, config, 0, -1);
+	}
+	else if (ch == KEY_UP && y > 0 && try_move(c, x, y, x, y - 1))
+	{
+		restore(c, y, x);
+		y--;
+		place_me(c, y, x);
+	}
+	else if (ch == KEY_DOWN && y == c.height - 1)
+	{
+		try_switch_chunk(c, config, 0, 1);
+	}
+	else if (ch == KEY_DOWN && try_move(c, x, y, x, y + 1))
+	{
+		restore(c, y, x);
+		y++;
+		place_me(c, y, x);
+	}
+	else if (ch == KEY_SLEFT)
+	{
+		while (try_move(c, x, y, x - 1, y))
 		{
 			restore(c, y, x);
 			x--;
 			place_me(c, y, x);
+			screen_pause(50);
 		}
-		else if (ch == KEY_RIGHT && x == c.width - 1)
-		{
-			try_switch_chunk(c, config, 1, 0);
-		}
-		else if (ch == KEY_RIGHT && try_move(c, x, y, x + 1, y))
+	}
+	else if (ch == KEY_SRIGHT)
+	{
+		while (try_move(c, x, y, x + 1, y))
 		{
 			restore(c, y, x);
 			x++;
 			place_me(c, y, x);
+			screen_pause(50);
 		}
-		else if (ch == KEY_UP && y == 0)
-		{
-			try_switch_chunk(c, config, 0, -1);
-		}
-		else if (ch == KEY_UP && y > 0 && try_move(c, x, y, x, y - 1))
+	}
+	else if (ch == KEY_SR)
+	{
+		while (try_move(c, x, y, x, y - 1))
 		{
 			restore(c, y, x);
 			y--;
 			place_me(c, y, x);
+			screen_pause(50);
 		}
-		else if (ch == KEY_DOWN && y == c.height - 1)
-		{
-			try_switch_chunk(c, config, 0, 1);
-		}
-		else if (ch == KEY_DOWN && try_move(c, x, y, x, y + 1))
+	}
+	else if (ch == KEY_SF)
+	{
+		while (try_move(c, x, y, x, y + 1))
 		{
 			restore(c, y, x);
 			y++;
 			place_me(c, y, x);
+			screen_pause(50);
 		}
-		else if (ch == KEY_SLEFT)
+	}
+}
+
+int main(int argc, char **argv)
+{
+	chunk_trace_init_from_env();
+	uint64_t value = time(nullptr);
+	std::vector<int> keys;
+	bool scripted = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
 		{
-			while (try_move(c, x, y, x - 1, y))
-			{
-				restore(c, y, x);
-				x--;
-				place_me(c, y, x);
-				napms(50);
-				refresh();
-			}
+			value = strtoull(argv[++i], nullptr, 10);
 		}
-		else if (ch == KEY_SRIGHT)
+		else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc)
 		{
-			while (try_move(c, x, y, x + 1, y))
+			scripted = true;
+			if (!script_load(argv[++i], keys))
 			{
-				restore(c, y, x);
-				x++;
-				place_me(c, y, x);
-				napms(50);
-				refresh();
+				printf("Could not read key script %s!\n", argv[i]);
+				return 1;
 			}
 		}
-		else if (ch == KEY_SR)
+		else if (strcmp(argv[i], "--walk") == 0 && i + 1 < argc)
 		{
-			while (try_move(c, x, y, x, y - 1))
-			{
-				restore(c, y, x);
-				y--;
-				place_me(c, y, x);
-				napms(50);
-				refresh();
-			}
+			scripted = true;
+			keys = script_random_walk(value, atoi(argv[++i]));
 		}
-		else if (ch == KEY_SF)
+		else
 		{
-			while (try_move(c, x, y, x, y + 1))
-			{
-				restore(c, y, x);
-				y++;
-				place_me(c, y, x);
-				napms(50);
-				refresh();
-			}
+			printf("Usage: %s [--seed S] [--script FILE | --walk STEPS]\n", argv[0]);
+			printf("With a key script or a random walk, runs without a terminal and reports frame times.\n");
+			return 1;
 		}
 	}
+	seed s(value, value);
+	chunkconfig config(s);
+	config.width = width;
+	config.height = height;
+	config.level_width = level_width;
+	config.level_height = level_height;
+	config.x = chunk_xpos;
+	config.y = chunk_ypos;
+	config.chaos = s.roll(0, 4);
+	config.openness = s.roll(0, 4);
+	chunk c(config);
+	generate_room(c, 0);
+
+	if (scripted)
+	{
+		screen_init_headless(width, height);
+		render_room(c);
+		run_headless(keys, [&c, &config](int ch) { handle_key(c, config, ch); });
+		return 0;
+	}
+
+	initscr();
+	clear();
+	noecho();
+	cbreak();
+	set_escdelay(25); // avoid annoying ESC handling delay; we won't use ALT keys anyways
+	keypad(stdscr, TRUE);
+	curs_set(0);
+	clear();
+	init_colors_once();
+	render_room(c);
+	int ch = 0;
+	while (1)
+	{
+		screen_put(y, x, me);
+		ch = getch();
+		if (ch == 'q' || ch == 'Q' || ch == 27) break;
+		handle_key(c, config, ch);
+	}
 	endwin();
 	return 0;
 }
@@ -2,6 +2,12 @@
 
 #include "chunky.h"
 #include <ncurses.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
 
 static char me = '@';
 
@@ -53,6 +59,8 @@ static chtype tile_glyph(uint8_t t)
 	case ENTITY_DAMAGE: return 'd';
 	case ENTITY_SPECIALIST: return 'P';
 	case ENTITY_WILD: return 'w';
+	case TILE_STAIRS_UP: return '{';
+	case TILE_STAIRS_DOWN: return '}';
 	default: assert(false); break;
 	}
 	return '?';
@@ -85,6 +93,8 @@ static short tile_color_pair(uint8_t t)
 	case ENTITY_WILD:
 		return 3;
 	case TILE_CHEST:
+	case TILE_STAIRS_UP:
+	case TILE_STAIRS_DOWN:
 		return 1;
 	default:
 		return 0;
@@ -102,3 +112,143 @@ static bool can_open_one_way(uint8_t tile, int dx, int dy)
 	default: return false;
 	}
 }
+
+// -- Screen output, to the terminal or off screen when running headless --
+
+static bool headless = false;
+static int offscreen_width = 0;
+static int offscreen_height = 0;
+static std::vector<chtype> offscreen;
+static std::vector<uint64_t> frame_ns; // time taken by each frame drawn headless
+static std::chrono::steady_clock::time_point frame_start;
+
+static void screen_init_headless(int width, int height)
+{
+	headless = true;
+	offscreen_width = width;
+	offscreen_height = height;
+	offscreen.assign(width * height, ' ');
+	frame_ns.clear();
+	frame_start = std::chrono::steady_clock::now();
+}
+
+static chtype tile_char(uint8_t t)
+{
+	chtype attrs = 0;
+	if (!headless && has_colors())
+	{
+		const short pair = tile_color_pair(t);
+		if (pair != 0) attrs |= COLOR_PAIR(pair);
+	}
+	return tile_glyph(t) | attrs;
+}
+
+static void screen_put(int y, int x, chtype c)
+{
+	if (!headless) mvaddch(y, x, c);
+	else if (x >= 0 && y >= 0 && x < offscreen_width && y < offscreen_height) offscreen[y * offscreen_width + x] = c;
+}
+
+/// Ends a frame. Headless, this records how long the frame took since the previous one ended.
+static void screen_refresh()
+{
+	if (!headless)
+	{
+		refresh();
+		return;
+	}
+	const auto now = std::chrono::steady_clock::now();
+	frame_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - frame_start).count());
+	frame_start = now;
+}
+
+static void screen_pause(int ms)
+{
+	if (!headless) napms(ms);
+}
+
+// -- Scripted input --
+
+/// Read keys from a script file: one of left, right, up, down, run-left, run-right, run-up, run-down, descend and
+/// ascend per word, with # starting a comment. Returns false if the file cannot be read or has unknown words.
+static bool script_load(const char* filename, std::vector<int>& keys)
+{
+	static const char* names[] = { "left", "right", "up", "down", "run-left", "run-right", "run-up", "run-down", "descend", "ascend" };
+	static const int codes[] = { KEY_LEFT, KEY_RIGHT, KEY_UP, KEY_DOWN, KEY_SLEFT, KEY_SRIGHT, KEY_SR, KEY_SF, '>', '<' };
+	FILE* fp = fopen(filename, "r");
+	if (!fp) return false;
+	char line[256];
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), fp))
+	{
+		char* comment = strchr(line, '#');
+		if (comment) *comment = '\0';
+		for (char* word = strtok(line, " \t\r\n"); word && ok; word = strtok(nullptr, " \t\r\n"))
+		{
+			unsigned i = 0;
+			while (i < sizeof(names) / sizeof(names[0]) && strcmp(word, names[i]) != 0) i++;
+			if (i == sizeof(names) / sizeof(names[0])) ok = false;
+			else keys.push_back(codes[i]);
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+/// A random walk of arrow keys, with the odd run thrown in.
+static std::vector<int> script_random_walk(uint64_t value, int steps)
+{
+	static const int arrows[] = { KEY_LEFT, KEY_RIGHT, KEY_UP, KEY_DOWN };
+	static const int runs[] = { KEY_SLEFT, KEY_SRIGHT, KEY_SR, KEY_SF };
+	seed s(value, value);
+	std::vector<int> keys;
+	int dir = 0;
+	for (int i = 0; i < steps; i++)
+	{
+		if (s.roll(0, 3) == 0) dir = s.roll(0, 3); // mostly keep going the same way
+		keys.push_back(s.roll(0, 19) == 0 ? runs[dir] : arrows[dir]);
+	}
+	return keys;
+}
+
+/// Feed keys to 'handle_key' with the screen off, then print frame latencies.
+template<typename F>
+static void run_headless(const std::vector<int>& keys, F handle_key)
+{
+	const auto start = std::chrono::steady_clock::now();
+	frame_ns.clear();
+	frame_start = start;
+	for (int key : keys) handle_key(key);
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%d keys, %d frames in %.3f s\n", (int)keys.size(), (int)frame_ns.size(), secs);
+	if (frame_ns.empty()) return;
+
+	std::vector<uint64_t> sorted = frame_ns;
+	std::sort(sorted.begin(), sorted.end());
+	auto pct = [&sorted](int p) { return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)] / 1000.0; };
+	printf("Frame us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", pct(50), pct(90), pct(99), sorted.back() / 1000.0);
+
+	// Power-of-two buckets in microseconds, so that stalls stand out from the usual frames
+	std::vector<int> buckets;
+	for (uint64_t ns : frame_ns)
+	{
+		unsigned b = 0;
+		while ((1000ull << b) <= ns) b++;
+		if (b >= buckets.size()) buckets.resize(b + 1, 0);
+		buckets[b]++;
+	}
+	const int most = *std::max_element(buckets.begin(), buckets.end());
+	for (unsigned b = 0; b < buckets.size(); b++)
+	{
+		printf("  < %8llu us %7d ", 1ull << b, buckets[b]);
+		for (int i = 0; i < (buckets[b] * 50 + most - 1) / most; i++) printf("#");
+		printf("\n");
+	}
+	std::vector<int> order(frame_ns.size());
+	for (unsigned i = 0; i < order.size(); i++) order[i] = i;
+	const int slowest = std::min<int>(order.size(), 5);
+	std::partial_sort(order.begin(), order.begin() + slowest, order.end(), [](int a, int b) { return frame_ns[a] > frame_ns[b]; });
+	printf("Slowest frames:");
+	for (int i = 0; i < slowest; i++) printf(" #%d (%.1f us)", order[i], frame_ns[order[i]] / 1000.0);
+	printf("\n");
+}
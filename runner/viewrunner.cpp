@@ -9,40 +9,115 @@
 #include <string.h>
 #include <time.h>
 
-static int x = 10;
-static int y = 10;
+#include <algorithm>
+#include <chrono>
+#include <vector>
 
+static int64_t x = 10;
+static int64_t y = 10;
 
-static void render_view(const chunkview &v, int player_x, int player_y)
+
+/// Keeps what should be on screen and what was last drawn, so that only changed cells are sent to the screen.
+struct painter
 {
-	int view_x_start = player_x - v.view_width() / 2;
-	int view_y_start = player_y - v.view_height() / 2;
+	painter(int w, int h) : width(w), height(h), want(w * h, 0), drawn(w * h, (chtype)-1) {}
+
+	int width;
+	int height;
+	std::vector<chtype> want;
+	std::vector<chtype> drawn;
+	long cells_drawn = 0;
 
-	for (int i = 0; i < v.view_height(); ++i)
+	void fetch(const chunkview &v, int x1, int y1, int x2, int y2)
 	{
-		for (int j = 0; j < v.view_width(); ++j)
+		const viewport_span tiles = v.viewport();
+		for (int i = std::max(0, y1); i <= std::min(height - 1, y2); ++i)
 		{
-			tile_type t = v.get_tile(view_x_start + j, view_y_start + i);
-			chtype attrs = 0;
-			if (has_colors())
+			for (int j = std::max(0, x1); j <= std::min(width - 1, x2); ++j)
 			{
-				const short pair = tile_color_pair(t);
-				if (pair != 0)
-					attrs |= COLOR_PAIR(pair);
+				want[i * width + j] = tile_char(tiles.at(j, i));
 			}
-			mvaddch(i, j, tile_glyph(t) | attrs);
 		}
 	}
-	refresh();
-}
 
+	void shift(int dx, int dy)
+	{
+		std::vector<chtype> old = want;
+		for (int i = 0; i < height; ++i)
+		{
+			const int oy = i + dy;
+			if (oy < 0 || oy >= height)
+				continue;
+			for (int j = 0; j < width; ++j)
+			{
+				const int ox = j + dx;
+				if (ox >= 0 && ox < width)
+					want[i * width + j] = old[oy * width + ox];
+			}
+		}
+	}
+
+	void put(int i, int j, chtype c)
+	{
+		if (drawn[i * width + j] == c)
+			return;
+		drawn[i * width + j] = c;
+		cells_drawn++;
+		screen_put(i, j, c);
+	}
+
+	void flush()
+	{
+		for (int i = 0; i < height; ++i)
+			for (int j = 0; j < width; ++j)
+				put(i, j, want[i * width + j]);
+		put(height / 2, width / 2, me);
+		screen_refresh();
+	}
+};
+
+/// Bring the screen up to date with the view, fetching only tiles that may have changed.
+static void render_view(chunkview &v, painter &p)
+{
+	const chunkview_changes ch = v.take_changes();
+	if (ch.full || abs(ch.scroll_x) >= p.width || abs(ch.scroll_y) >= p.height)
+	{
+		p.fetch(v, 0, 0, p.width - 1, p.height - 1);
+	}
+	else
+	{
+		if (ch.scroll_x != 0 || ch.scroll_y != 0)
+			p.shift(ch.scroll_x, ch.scroll_y);
+		if (ch.scroll_x > 0)
+			p.fetch(v, p.width - ch.scroll_x, 0, p.width - 1, p.height - 1);
+		else if (ch.scroll_x < 0)
+			p.fetch(v, 0, 0, -ch.scroll_x - 1, p.height - 1);
+		if (ch.scroll_y > 0)
+			p.fetch(v, 0, p.height - ch.scroll_y, p.width - 1, p.height - 1);
+		else if (ch.scroll_y < 0)
+			p.fetch(v, 0, 0, p.width - 1, -ch.scroll_y - 1);
+		for (const coords &t : ch.tiles)
+		{
+			const int tx = (int)(t.x - v.view_x());
+			const int ty = (int)(t.y - v.view_y());
+			p.fetch(v, tx, ty, tx, ty);
+		}
+		for (const coords &c : ch.chunks)
+		{
+			const int x1 = (int)(c.x * v.chunk_width() - v.view_x());
+			const int y1 = (int)(c.y * v.chunk_height() - v.view_y());
+			p.fetch(v, x1, y1, x1 + v.chunk_width() - 1, y1 + v.chunk_height() - 1);
+		}
+	}
+	p.flush();
+}
 
-static bool try_move(chunkview &v, int from_x, int from_y, int to_x, int to_y)
+static bool try_move(chunkview &v, int64_t from_x, int64_t from_y, int64_t to_x, int64_t to_y)
 {
-	const int dx = to_x - from_x;
-	const int dy = to_y - from_y;
+	const int dx = (int)(to_x - from_x);
+	const int dy = (int)(to_y - from_y);
 	tile_type tile = v.get_tile(to_x, to_y);
-	if (tile == TILE_EMPTY)
+	if (tile == TILE_EMPTY || tile == TILE_STAIRS_UP || tile == TILE_STAIRS_DOWN)
 		return true;
 	if (tile == TILE_DOOR_OPEN)
 		return true;
@@ -62,15 +137,213 @@ static bool try_move(chunkview &v, int from_x, int from_y, int to_x, int to_y)
 	return false;
 }
 
-int main()
+/// Take the stairs we stand on, arriving at the other end of them on the floor above or below.
+static void take_stairs(chunkview &v, int dz)
+{
+	if (v.get_tile(x, y) != (dz > 0 ? TILE_STAIRS_DOWN : TILE_STAIRS_UP))
+		return;
+	const int w = v.chunk_width();
+	const int h = v.chunk_height();
+	const int64_t x1 = x - ((x % w) + w) % w;
+	const int64_t y1 = y - ((y % h) + h) % h;
+	v.set_floor(v.floor() + dz);
+	for (int64_t j = y1; j < y1 + h; ++j)
+	{
+		for (int64_t i = x1; i < x1 + w; ++i)
+		{
+			if (v.get_tile(i, j) == (dz > 0 ? TILE_STAIRS_UP : TILE_STAIRS_DOWN))
+			{
+				x = i;
+				y = j;
+				return;
+			}
+		}
+	}
+	v.set_floor(v.floor() - dz); // no room for the other end of the stairs
+}
+
+static void handle_key(chunkview &v, painter &p, int ch)
+{
+	if (ch == '>' || ch == '<')
+		take_stairs(v, ch == '>' ? 1 : -1);
+
+	int64_t new_x = x;
+	int64_t new_y = y;
+
+	if (ch == KEY_LEFT)
+		new_x--;
+	else if (ch == KEY_RIGHT)
+		new_x++;
+	else if (ch == KEY_UP)
+		new_y--;
+	else if (ch == KEY_DOWN)
+		new_y++;
+
+	if (try_move(v, x, y, new_x, new_y))
+	{
+		x = new_x;
+		y = new_y;
+	}
+
+	if (ch == KEY_SLEFT)
+	{
+		while (try_move(v, x, y, x - 1, y))
+		{
+			x--;
+			v.change_position(x, y);
+			render_view(v, p);
+			screen_pause(50);
+		}
+	}
+	else if (ch == KEY_SRIGHT)
+	{
+		while (try_move(v, x, y, x + 1, y))
+		{
+			x++;
+			v.change_position(x, y);
+			render_view(v, p);
+			screen_pause(50);
+		}
+	}
+	else if (ch == KEY_SR)
+	{
+		while (try_move(v, x, y, x, y - 1))
+		{
+			y--;
+			v.change_position(x, y);
+			render_view(v, p);
+			screen_pause(50);
+		}
+	}
+	else if (ch == KEY_SF)
+	{
+		while (try_move(v, x, y, x, y + 1))
+		{
+			y++;
+			v.change_position(x, y);
+			render_view(v, p);
+			screen_pause(50);
+		}
+	}
+
+	v.change_position(x, y);
+	render_view(v, p);
+}
+
+static uint64_t percentile(std::vector<uint64_t> &sorted, int pct)
+{
+	return sorted[std::min(sorted.size() - 1, sorted.size() * pct / 100)];
+}
+
+/// Walk around at random without a terminal, timing each frame with and without change tracking.
+static int bench(const chunkconfig &config, int steps, int width, int height)
+{
+	screen_init_headless(width, height);
+	chunkview v(config, width, height);
+	painter p(width, height);
+	seed walk(config.orig.orig);
+	std::vector<uint64_t> incremental;
+	std::vector<uint64_t> full;
+	long cells = 0;
+	v.change_position(x, y);
+	render_view(v, p);
+	for (int i = 0; i < steps; ++i)
+	{
+		const int dir = walk.roll(0, 3);
+		const int dx = (dir == 0) ? -1 : (dir == 1) ? 1 : 0;
+		const int dy = (dir == 2) ? -1 : (dir == 3) ? 1 : 0;
+		if (try_move(v, x, y, x + dx, y + dy))
+		{
+			x += dx;
+			y += dy;
+		}
+		v.change_position(x, y);
+		const long before = p.cells_drawn;
+		auto t0 = std::chrono::steady_clock::now();
+		render_view(v, p);
+		auto t1 = std::chrono::steady_clock::now();
+		cells += p.cells_drawn - before;
+		p.fetch(v, 0, 0, width - 1, height - 1); // redraw every cell, as if nothing was tracked
+		p.drawn.assign(p.drawn.size(), (chtype)-1);
+		p.flush();
+		auto t2 = std::chrono::steady_clock::now();
+		incremental.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+		full.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+	}
+	std::sort(incremental.begin(), incremental.end());
+	std::sort(full.begin(), full.end());
+	printf("%d frames of %dx%d, %.1f cells drawn per frame\n", steps, width, height, (double)cells / steps);
+	printf("Changed only: p50 %.1f us, p99 %.1f us\n", percentile(incremental, 50) / 1000.0, percentile(incremental, 99) / 1000.0);
+	printf("Full redraw:  p50 %.1f us, p99 %.1f us\n", percentile(full, 50) / 1000.0, percentile(full, 99) / 1000.0);
+	return 0;
+}
+
+int main(int argc, char **argv)
 {
+	chunk_trace_init_from_env();
 	uint64_t value = time(nullptr);
+	int bench_steps = 0;
+	int walk_steps = 0;
+	const char *script = nullptr;
+	bool unbounded = false;
+	int floors = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			value = strtoull(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+			bench_steps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+			script = argv[++i];
+		else if (strcmp(argv[i], "--walk") == 0 && i + 1 < argc)
+			walk_steps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--unbounded") == 0)
+			unbounded = true;
+		else if (strcmp(argv[i], "--floors") == 0 && i + 1 < argc)
+			floors = std::max(1, atoi(argv[++i]));
+		else
+		{
+			printf("Usage: %s [--seed S] [--unbounded] [--floors N] [--script FILE | --walk STEPS | --bench STEPS]\n", argv[0]);
+			printf("With a key script or a random walk, runs without a terminal and reports frame times.\n");
+			printf("An unbounded world has no edges; we start a trillion tiles away from its origin.\n");
+			printf("With several floors, use > and < on stairs to go down and up.\n");
+			return 1;
+		}
+	}
 	seed s(value, value);
 	chunkconfig config(s);
 	config.level_width = 8;
 	config.level_height = 8;
 	config.chaos = s.roll(0, 4);
 	config.openness = s.roll(0, 4);
+	config.floors = floors;
+	if (unbounded)
+	{
+		config.unbounded = true;
+		x = y = 1000000000010ll;
+	}
+	if (bench_steps > 0)
+		return bench(config, bench_steps, 160, 48);
+	if (script || walk_steps > 0)
+	{
+		std::vector<int> keys;
+		if (script && !script_load(script, keys))
+		{
+			printf("Could not read key script %s!\n", script);
+			return 1;
+		}
+		if (!script)
+			keys = script_random_walk(value, walk_steps);
+		screen_init_headless(160, 48);
+		chunkview v(config, 160, 48);
+		painter p(160, 48);
+		v.change_position(x, y);
+		render_view(v, p);
+		run_headless(keys, [&v, &p](int ch) { handle_key(v, p, ch); });
+		if (unbounded)
+			printf("Chunks held at the end: %d, evicted: %d\n", (int)v.cache().size(), (int)v.cache().evicted());
+		return 0;
+	}
 
 	initscr();
 	clear();
@@ -85,88 +358,18 @@ int main()
 	getmaxyx(stdscr, term_height, term_width);
 
 	chunkview v(config, term_width, term_height);
+	painter p(term_width, term_height);
 	v.change_position(x, y);
-	render_view(v, x, y);
+	render_view(v, p);
 
 	int ch = 0;
 	while (1)
 	{
-		mvaddch(v.view_height() / 2, v.view_width() / 2, me);
-		refresh();
-
 		ch = getch();
 		if (ch == 'q' || ch == 'Q' || ch == 27)
 			break;
 
-		int new_x = x;
-		int new_y = y;
-
-		if (ch == KEY_LEFT)
-			new_x--;
-		else if (ch == KEY_RIGHT)
-			new_x++;
-		else if (ch == KEY_UP)
-			new_y--;
-		else if (ch == KEY_DOWN)
-			new_y++;
-
-		if (try_move(v, x, y, new_x, new_y))
-		{
-			x = new_x;
-			y = new_y;
-		}
-
-		if (ch == KEY_SLEFT)
-		{
-			while (try_move(v, x, y, x - 1, y))
-			{
-				x--;
-				v.change_position(x, y);
-				render_view(v, x, y);
-				mvaddch(v.view_height() / 2, v.view_width() / 2, me);
-				refresh();
-				napms(50);
-			}
-		}
-		else if (ch == KEY_SRIGHT)
-		{
-			while (try_move(v, x, y, x + 1, y))
-			{
-				x++;
-				v.change_position(x, y);
-				render_view(v, x, y);
-				mvaddch(v.view_height() / 2, v.view_width() / 2, me);
-				refresh();
-				napms(50);
-			}
-		}
-		else if (ch == KEY_SR)
-		{
-			while (try_move(v, x, y, x, y - 1))
-			{
-				y--;
-				v.change_position(x, y);
-				render_view(v, x, y);
-				mvaddch(v.view_height() / 2, v.view_width() / 2, me);
-				refresh();
-				napms(50);
-			}
-		}
-		else if (ch == KEY_SF)
-		{
-			while (try_move(v, x, y, x, y + 1))
-			{
-				y++;
-				v.change_position(x, y);
-				render_view(v, x, y);
-				mvaddch(v.view_height() / 2, v.view_width() / 2, me);
-				refresh();
-				napms(50);
-			}
-		}
-
-		v.change_position(x, y);
-		render_view(v, x, y);
+		handle_key(v, p, ch);
 	}
 	endwin();
 	return 0;
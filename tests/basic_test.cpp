@@ -146,8 +146,179 @@ static void stress_test(seed s, bool debug)
 	if (debug) print_room(c, r.index);
 }
 
+// Rerolling a room must change nothing outside of it, and give the same room for the same seed
+static int reroll_test(seed s)
+{
+	chunkconfig config(s);
+	config.level_width = 4;
+	config.level_height = 4;
+	config.x = 1;
+	config.y = 1;
+	chunk c(config);
+	c.generate_exits();
+	chunk_filter_connect_exits(c);
+	chunk_filter_room_expand(c, 4, 10);
+	chunk_filter_room_in_room(c);
+	chunk_filter_wildlife(c);
+	c.self_test();
+	int changed = 0;
+	for (unsigned i = 0; i < c.rooms.size(); i++)
+	{
+		const room r = c.rooms.at(i);
+		chunk a = c;
+		if (!chunk_room_reroll(a, i, seed(7)))
+		{
+			assert(r.flags & (ROOM_FLAG_CORRIDOR | ROOM_FLAG_NESTED));
+			continue;
+		}
+		a.self_test();
+		chunk b = c;
+		chunk_room_reroll(b, i, seed(7));
+		assert(a.hash() == b.hash());
+		for (int y = 0; y < c.height; y++) for (int x = 0; x < c.width; x++) if (!r.is_inside(x, y)) assert(a.at(x, y) == c.at(x, y));
+		int outside = 0;
+		for (const entity& e : c.entities) outside += !r.is_inside(e.x, e.y);
+		for (const entity& e : a.entities) outside -= !r.is_inside(e.x, e.y);
+		assert(outside == 0);
+		chunk d = c;
+		chunk_room_reroll(d, i, seed(9));
+		changed += (d.hash() != a.hash());
+
+		// Rerolls remove entities, and rolling back must bring them back
+		chunk t = c;
+		t.begin();
+		chunk_room_reroll(t, i, seed(7));
+		assert(t.hash() == a.hash());
+		t.rollback();
+		assert(t.hash() == c.hash() && t.entities.size() == c.entities.size());
+		t.self_test();
+	}
+	chunk e = c;
+	const int rerolled = chunk_area_reroll(e, 0, 0, c.width - 1, c.height - 1, seed(8));
+	assert(rerolled > 0);
+	(void)rerolled;
+	e.self_test();
+	return changed;
+}
+
+// Stairs, the chest and the boss must survive rerolling the whole chunk, tiles and all
+static int reroll_keeps_test(seed s)
+{
+	chunkconfig config(s);
+	config.level_width = 4;
+	config.level_height = 4;
+	config.floors = 3;
+	config.z = 1;
+	config.x = s.roll(0, 3);
+	config.y = s.roll(0, 3);
+	chunk c(config);
+	c.generate_exits();
+	chunk_filter_connect_exits(c);
+	chunk_filter_room_expand(c, 4, 10);
+	chunk_filter_room_in_room(c);
+	c.beautify();
+	room& r = chunk_filter_boss_placement(c, 0);
+	chunk_filter_protect_room(c, r);
+	chunk_filter_wildlife(c);
+	chunk_filter_chest(c);
+	chunk_filter_stairs(c);
+	std::vector<entity> kept;
+	for (const entity& e : c.entities)
+	{
+		if (e.type == TILE_STAIRS_UP || e.type == TILE_STAIRS_DOWN || e.type == TILE_CHEST || e.type == ENTITY_BOSS) kept.push_back(e);
+	}
+	int stairs = 0;
+	for (const entity& e : kept) stairs += (e.type == TILE_STAIRS_UP || e.type == TILE_STAIRS_DOWN);
+	chunk_area_reroll(c, 0, 0, c.width - 1, c.height - 1, seed(5));
+	c.self_test();
+	for (const entity& k : kept)
+	{
+		int found = 0;
+		for (const entity& e : c.entities) found += (e.type == k.type && e.x == k.x && e.y == k.y);
+		assert(found == 1 && c.at(k.x, k.y) == k.type);
+		(void)found;
+	}
+	return stairs;
+}
+
+// Rolling back must give back exactly the chunk we had, also from nested transactions
+static void transaction_test(seed s)
+{
+	chunkconfig config(s);
+	config.level_width = 4;
+	config.level_height = 4;
+	config.x = 1;
+	config.y = 2;
+	chunk c(config);
+	c.generate_exits();
+	chunk_filter_connect_exits(c);
+	c.build_mip();
+	const uint64_t skeleton = c.hash();
+
+	c.begin();
+	chunk_filter_room_expand(c, 4, 10);
+	const uint64_t expanded = c.hash();
+	c.begin();
+	chunk_filter_room_in_room(c);
+	chunk_filter_one_way_doors(c, 2);
+	room& r = chunk_filter_boss_placement(c, 0);
+	chunk_filter_protect_room(c, r);
+	chunk_filter_wildlife(c);
+	assert(c.hash() != expanded);
+	c.rollback();
+	assert(c.hash() == expanded);
+	(void)expanded;
+	c.self_test();
+	c.begin();
+	chunk_filter_wildlife(c);
+	c.commit();
+	assert(c.journaling());
+	c.rollback();
+	assert(!c.journaling());
+	assert(c.hash() == skeleton);
+	(void)skeleton;
+	c.self_test();
+	chunk rebuilt = c;
+	rebuilt.build_mip();
+	for (int level = 0; level < chunkmip::LEVELS; level++) assert(rebuilt.mip.cells[level] == c.mip.cells[level]);
+
+	// Committed changes stay
+	c.begin();
+	chunk_filter_room_expand(c, 4, 10);
+	c.commit();
+	assert(c.hash() != skeleton && !c.journaling());
+}
+
+// Rooms placed as largest empty rectangles must be as valid as grown ones
+static void expand_max_test(seed s)
+{
+	chunkconfig config(s);
+	config.width = 1 << s.roll(5, 7);
+	config.height = 1 << s.roll(5, 7);
+	config.level_width = 4;
+	config.level_height = 4;
+	config.x = s.roll(0, 3);
+	config.y = s.roll(0, 3);
+	chunk c(config);
+	c.generate_exits();
+	chunk_filter_connect_exits(c);
+	const size_t corridors = c.rooms.size();
+	chunk_filter_room_expand_max(c, 2, 8);
+	c.self_test();
+	assert(c.rooms.size() > corridors);
+	for (unsigned i = corridors; i < c.rooms.size(); i++)
+	{
+		const room& r = c.rooms.at(i);
+		assert(r.x2 - r.x1 >= 2 && r.y2 - r.y1 >= 2);
+		for (int y = r.y1; y <= r.y2; y++) for (int x = r.x1; x <= r.x2; x++) assert(!c.rock(x, y));
+	}
+	chunk_filter_room_in_room(c);
+	c.self_test();
+}
+
 int main(int argc, char **argv)
 {
+	chunk_trace_init_from_env(); // set CHUNKY_TRACE=file.json to record a timeline
 	test_grand_central(seed_random());
 	test_inner_loop(seed_random());
 	exit_test();
@@ -159,6 +330,17 @@ int main(int argc, char **argv)
 	printf("Showing room from seed %llu:\n", (unsigned long long)value);
 	stress_test(seed(value, value), true);
 
+	for (int i = 0; i < 16; i++) transaction_test(seed(i));
+	for (int i = 0; i < 64; i++) expand_max_test(seed(i));
+
+	int rerolls_changed = 0;
+	for (int i = 0; i < 16; i++) rerolls_changed += reroll_test(seed(i));
+	assert(rerolls_changed > 0);
+	int stairs = 0;
+	for (int i = 0; i < 32; i++) stairs += reroll_keeps_test(seed(i));
+	assert(stairs > 0);
+	(void)stairs;
+
 	// Stress test - deterministic
 	for (int i = 0; i < 256; i++)
 	{
@@ -0,0 +1,224 @@
+#include "chunkcache.h"
+#include "chunkview.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static const int threads = 8;
+
+[[maybe_unused]] static bool same_chunk(const chunk& a, const chunk& b)
+{
+	if (a.width != b.width || a.height != b.height || a.rooms.size() != b.rooms.size() || a.entities.size() != b.entities.size()) return false;
+	for (int y = 0; y < a.height; y++) for (int x = 0; x < a.width; x++) if (a.at(x, y) != b.at(x, y)) return false;
+	return true;
+}
+
+// Everyone asks for the same chunk at the same time; it must be generated only once.
+static void contended_miss_test()
+{
+	seed s(1);
+	chunkconfig config(s);
+	chunkcache cache(config);
+	std::vector<std::thread> pool;
+	std::vector<const chunk*> seen(threads, nullptr);
+	for (int i = 0; i < threads; i++)
+	{
+		pool.emplace_back([&cache, &seen, i] { chunkpin p = cache.pin({ 3, 4 }); seen[i] = p.get(); assert(p->rooms.size() > 0); });
+	}
+	for (std::thread& t : pool) t.join();
+	assert(cache.generated() == 1);
+	assert(cache.size() == 1);
+	for (int i = 1; i < threads; i++) assert(seen[i] == seen[0]);
+	const size_t evicted = cache.evict_unpinned();
+	assert(evicted == 1);
+	(void)evicted;
+	assert(cache.size() == 0);
+}
+
+// Many views roam the same world at once. Every chunk must be generated exactly once, and must
+// be identical to a chunk generated on its own.
+static void shared_views_test()
+{
+	seed s(2);
+	chunkconfig config(s);
+	config.level_width = 8;
+	config.level_height = 8;
+	chunkcache cache(config);
+	const int steps = 200;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; i++)
+	{
+		pool.emplace_back([&cache, i]
+		{
+			seed walk(100 + i);
+			chunkview v(cache, 64, 32);
+			int x = walk.roll(0, 255);
+			int y = walk.roll(0, 255);
+			for (int j = 0; j < steps; j++)
+			{
+				x = std::max(0, std::min(255, x + walk.roll(-16, 16)));
+				y = std::max(0, std::min(255, y + walk.roll(-16, 16)));
+				v.change_position(x, y);
+				assert(v.get_tile(0, 0) == TILE_ROCK);
+				v.self_test();
+			}
+		});
+	}
+	for (std::thread& t : pool) t.join();
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	assert(cache.generated() == cache.size());
+	assert(cache.size() <= 64);
+	printf("%d views x %d moves: %lu chunks generated, %.1f ms, %.0f moves/s\n", threads, steps, (unsigned long)cache.generated(), secs * 1000.0, threads * steps / secs);
+
+	for (int cx = 0; cx < 8; cx++)
+	{
+		for (int cy = 0; cy < 8; cy++)
+		{
+			chunkpin p = cache.find({ cx, cy });
+			if (!p) continue;
+			chunkconfig fresh = config;
+			fresh.x = cx;
+			fresh.y = cy;
+			chunk c(fresh);
+			chunkcache_generate(c);
+			assert(same_chunk(*p, c));
+		}
+	}
+}
+
+// Threads ask for skeletons and full chunks of the same area at the same time. Holders of a skeleton
+// must never see it change, and upgraded chunks must match those generated in one go.
+static void mixed_detail_test()
+{
+	seed s(4);
+	chunkconfig config(s);
+	config.level_width = 4;
+	config.level_height = 4;
+	chunkcache cache(config);
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; i++)
+	{
+		pool.emplace_back([&cache, i]
+		{
+			seed r(300 + i);
+			for (int j = 0; j < 64; j++)
+			{
+				const coords pos = { r.roll(0, 3), r.roll(0, 3) };
+				chunkpin p = cache.pin(pos, r.roll(DETAIL_SKELETON, DETAIL_FULL));
+				const size_t rooms = p->rooms.size();
+				const int detail = p.detail();
+				chunkpin full = cache.pin(pos, DETAIL_FULL);
+				assert(p->rooms.size() == rooms && p.detail() == detail);
+				(void)rooms;
+				(void)detail;
+				assert(detail == DETAIL_FULL || full.get() != p.get());
+			}
+		});
+	}
+	for (std::thread& t : pool) t.join();
+	assert(cache.generated() == cache.size());
+	for (int cx = 0; cx < 4; cx++)
+	{
+		for (int cy = 0; cy < 4; cy++)
+		{
+			chunkpin p = cache.find({ cx, cy });
+			assert(p.detail() == DETAIL_FULL);
+			chunkconfig fresh = config;
+			fresh.x = cx;
+			fresh.y = cy;
+			chunk c(fresh);
+			chunkcache_generate(c);
+			assert(same_chunk(*p, c));
+		}
+	}
+}
+
+// Raw pin/unpin throughput on a warm cache.
+static void throughput_test()
+{
+	seed s(3);
+	chunkconfig config(s);
+	config.level_width = 16;
+	config.level_height = 16;
+	chunkcache cache(config);
+	for (int cx = 0; cx < 16; cx++) for (int cy = 0; cy < 16; cy++) cache.pin({ cx, cy });
+	const int lookups = 200000;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; i++)
+	{
+		pool.emplace_back([&cache, i]
+		{
+			seed r(200 + i);
+			for (int j = 0; j < lookups; j++)
+			{
+				chunkpin p = cache.pin({ r.roll(0, 15), r.roll(0, 15) });
+				assert(p);
+			}
+		});
+	}
+	for (std::thread& t : pool) t.join();
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	assert(cache.generated() == 256);
+	printf("%d threads: %.1f million pins/s\n", threads, threads * lookups / secs / 1000000.0);
+}
+
+// Packed chunks must come back exactly as they were, and only unpinned chunks may be packed.
+static void pack_test()
+{
+	seed s(9);
+	chunkconfig c(s);
+	chunkcache cache(c);
+	for (int i = 0; i < 16; i++)
+	{
+		const coords pos = { i % 4, i / 4 };
+		chunkpin p = cache.pin(pos);
+		const uint64_t h = p->hash();
+		chunk copy = *p;
+		const bool pinned = cache.pack(pos);
+		assert(!pinned);
+		p.release();
+		const bool packed = cache.pack(pos);
+		assert(packed);
+		const bool again = cache.pack(pos);
+		assert(!again);
+		p = cache.find(pos);
+		assert(!p->packed() && p->hash() == h && same_chunk(*p, copy));
+		p.release();
+		const bool repacked = cache.pack(pos);
+		assert(repacked);
+		(void)h;
+		(void)pinned;
+		(void)packed;
+		(void)again;
+		(void)repacked;
+	}
+	chunkcache_packing stats = cache.packing();
+	assert(stats.packed == 16 && stats.inflations == 16 && stats.ratio() > 1.0);
+	assert(stats.raw_bytes == 16 * (size_t)c.width * c.height);
+	chunkpin again = cache.pin({ 1, 1 }, DETAIL_SKELETON);
+	assert(!again->packed() && cache.packing().packed == 15);
+	again.release();
+	printf("packed 16 chunks %.1fx, inflating took %.2f us each\n", stats.ratio(), stats.inflate_us());
+	const size_t evicted = cache.evict_unpinned();
+	assert(evicted == 16);
+	(void)evicted;
+	stats = cache.packing();
+	assert(stats.packed == 0 && stats.raw_bytes == 0 && stats.packed_bytes == 0);
+}
+
+int main()
+{
+	chunk_trace_init_from_env(); // set CHUNKY_TRACE=file.json to record a timeline
+	contended_miss_test();
+	shared_views_test();
+	mixed_detail_test();
+	throughput_test();
+	pack_test();
+	return 0;
+}
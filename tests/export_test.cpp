@@ -0,0 +1,155 @@
+#include "chunkexport.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const int count = 64;
+static const char* filename = "export_test.bin";
+
+static chunkconfig make_config(uint64_t value)
+{
+	seed s(value, value);
+	chunkconfig config(s);
+	config.width = 64;
+	config.height = 32;
+	config.x = value % config.level_width;
+	if (value % 3 == 0) // chunks of an unbounded world, whose coordinates need all 64 bits
+	{
+		config.unbounded = true;
+		config.x = ((int64_t)1 << 40) + value;
+		config.y = -(int64_t)value;
+	}
+	if (value % 4 == 1) // a lower floor, which rolls from its own seed
+	{
+		config.floors = 3;
+		config.z = 1 + value % 2;
+	}
+	config.chaos = s.roll(0, 4);
+	config.openness = s.roll(0, 4);
+	return config;
+}
+
+static void generate(chunk& c)
+{
+	c.generate_exits();
+	chunk_filter_connect_exits(c);
+	chunk_filter_room_expand(c, 4, 10);
+	chunk_filter_room_in_room(c);
+	chunk_filter_one_way_doors(c, 2);
+	c.beautify();
+	room& r = chunk_filter_boss_placement(c, 0);
+	chunk_filter_protect_room(c, r);
+	chunk_filter_wildlife(c);
+	chunk_filter_chest(c);
+}
+
+static void compare(const chunkrecord& r, const chunk& c, uint64_t value)
+{
+	assert(r.value == value);
+	assert(r.x == c.config.x && r.y == c.config.y && r.z == c.config.z);
+	assert(r.width == c.width && r.height == c.height);
+	assert(r.chaos == c.config.chaos && r.openness == c.config.openness);
+	assert(r.top == c.top && r.bottom == c.bottom && r.left == c.left && r.right == c.right);
+	assert(memcmp(r.tiles.data(), c.tiles(), r.tiles.size()) == 0);
+	assert(r.rooms.size() == c.rooms.size());
+	for (unsigned i = 0; i < r.rooms.size(); i++)
+	{
+		const room& a = r.rooms[i];
+		const room& b = c.rooms[i];
+		assert(a == b && a.top == b.top && a.bottom == b.bottom && a.left == b.left && a.right == b.right);
+		assert(a.isolation == b.isolation && a.flags == b.flags && a.index == b.index);
+		(void)a;
+		(void)b;
+	}
+	assert(r.entities.size() == c.entities.size());
+	for (unsigned i = 0; i < r.entities.size(); i++)
+	{
+		const entity& a = r.entities[i];
+		const entity& b = c.entities[i];
+		assert(a.type == b.type && a.x == b.x && a.y == b.y && a.room_index == b.room_index);
+		(void)a;
+		(void)b;
+	}
+	(void)value;
+}
+
+// Chunks made on many threads come out in order, and read back exactly as generated.
+static void roundtrip_test()
+{
+	FILE* fp = fopen(filename, "wb");
+	assert(fp);
+	{
+		chunkwriter out(fp, 4096); // small, so that we flush a lot and write big records directly
+		chunkexport_ordered ordered(out, 4);
+		std::atomic<int> next(0);
+		std::vector<std::thread> pool;
+		for (int t = 0; t < 4; t++)
+		{
+			pool.emplace_back([&ordered, &next]
+			{
+				for (int i = next++; i < count; i = next++)
+				{
+					chunk c(make_config(1000 + i));
+					generate(c);
+					std::string record;
+					chunkexport_append(record, c, 1000 + i, EXPORT_BINARY);
+					ordered.submit(i, std::move(record));
+				}
+			});
+		}
+		for (std::thread& t : pool) t.join();
+		assert(ordered.written() == count);
+		const bool flushed = out.flush();
+		assert(flushed);
+		(void)flushed;
+	}
+	fclose(fp);
+
+	fp = fopen(filename, "rb");
+	assert(fp);
+	chunkrecord r;
+	for (int i = 0; i < count; i++)
+	{
+		const bool read = chunkexport_read(fp, r);
+		assert(read);
+		(void)read;
+		chunk c(make_config(1000 + i));
+		generate(c);
+		compare(r, c, 1000 + i);
+	}
+	const bool more = chunkexport_read(fp, r);
+	assert(!more);
+	(void)more;
+	fclose(fp);
+	remove(filename);
+}
+
+static void json_test()
+{
+	chunk c(make_config(7));
+	generate(c);
+	std::string line;
+	chunkexport_append(line, c, 7, EXPORT_JSONL);
+	assert(line.compare(0, 10, "{\"seed\":7,") == 0);
+	assert(line.back() == '\n' && line.find('\n') == line.size() - 1);
+	const size_t tiles = line.find("\"tiles\":\"") + 9;
+	assert(line[tiles + c.width * c.height * 2] == '"');
+	char hex[3];
+	snprintf(hex, sizeof(hex), "%02x", c.at(3, 2));
+	assert(line.compare(tiles + (2 * c.width + 3) * 2, 2, hex) == 0);
+	(void)tiles;
+	int depth = 0;
+	for (char ch : line) { if (ch == '[' || ch == '{') depth++; if (ch == ']' || ch == '}') depth--; assert(depth >= 0); }
+	assert(depth == 0);
+}
+
+int main()
+{
+	roundtrip_test();
+	json_test();
+	return 0;
+}
@@ -0,0 +1,267 @@
+// Generates chunks for a fixed matrix of seeds, sizes, positions and configs through every pipeline we ship,
+// and compares their hashes against a checked-in table. Any change to these hashes breaks saved worlds.
+// The table records a fingerprint of the dice it was made with; against other dice, or without a table, only
+// determinism is checked and the test reports itself as skipped.
+//
+// Usage: golden_test TABLE            compare against TABLE
+//        golden_test --update TABLE   rewrite TABLE from the current code
+
+#include "chunkcache.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum
+{
+	PIPE_BASIC, // tests/basic_test.cpp
+	PIPE_CHUNKGEN_MAIN, // chunkgen.cpp, all three methods
+	PIPE_CHUNKGEN_INNER,
+	PIPE_CHUNKGEN_GRAND,
+	PIPE_VIEW, // chunkview.cpp, by way of chunkcache
+	PIPE_COUNT
+};
+
+static const char* pipe_names[PIPE_COUNT] = { "basic", "chunkgen-main", "chunkgen-inner", "chunkgen-grand", "view" };
+
+enum
+{
+	WORLD_FLAT, // one floor inside the level
+	WORLD_MIDDLE, // middle of three floors, with stairs up and down
+	WORLD_BOTTOM, // bottom of three floors, with stairs up
+	WORLD_OPEN, // unbounded, far from the origin
+	WORLD_COUNT
+};
+
+static const char* world_names[WORLD_COUNT] = { "flat", "middle", "bottom", "open" };
+
+struct golden_case
+{
+	int pipe;
+	int world;
+	int width;
+	int height;
+	int x;
+	int y;
+	int chaos;
+	int openness;
+	uint64_t seed;
+
+	std::string key() const
+	{
+		char buf[128];
+		snprintf(buf, sizeof(buf), "%s %s %d %d %d %d %d %d %" PRIu64, pipe_names[pipe], world_names[world], width, height, x, y, chaos, openness, seed);
+		return buf;
+	}
+};
+
+static std::vector<golden_case> matrix()
+{
+	static const int sizes[][2] = { { 32, 32 }, { 64, 32 }, { 128, 64 }, { 256, 256 } };
+	static const int positions[][2] = { { 0, 0 }, { 1, 2 }, { 3, 3 } };
+	static const int configs[][2] = { { 1, 2 }, { 4, 0 } }; // chaos, openness
+	std::vector<golden_case> cases;
+	for (int pipe = 0; pipe < PIPE_COUNT; pipe++)
+		for (const auto& size : sizes)
+			for (const auto& pos : positions)
+				for (const auto& cfg : configs)
+					for (uint64_t s = 0; s < 4; s++)
+						cases.push_back({ pipe, WORLD_FLAT, size[0], size[1], pos[0], pos[1], cfg[0], cfg[1], s });
+	// Other worlds on the smaller sizes only, to keep the run short; every chunk of a 4x4 level has stairs on some seed
+	static const int open_positions[][2] = { { -3, 5 }, { 7, -1 }, { 100000, -70000 } };
+	for (int pipe = 0; pipe < PIPE_COUNT; pipe++)
+		for (int world = WORLD_MIDDLE; world < WORLD_COUNT; world++)
+			for (int i = 0; i < 2; i++)
+				for (int p = 0; p < 3; p++)
+					for (uint64_t s = 0; s < 4; s++)
+					{
+						const int* pos = (world == WORLD_OPEN) ? open_positions[p] : positions[p];
+						cases.push_back({ pipe, world, sizes[i][0], sizes[i][1], pos[0], pos[1], configs[s % 2][0], configs[s % 2][1], s });
+					}
+	return cases;
+}
+
+static int count_stairs(const chunk& c)
+{
+	int n = 0;
+	for (const entity& e : c.entities) n += (e.type == TILE_STAIRS_UP || e.type == TILE_STAIRS_DOWN);
+	return n;
+}
+
+// Also counts the stairs placed, if asked to
+static uint64_t generate(const golden_case& gc, int* stairs = nullptr)
+{
+	seed s(gc.seed, gc.seed);
+	chunkconfig config(s);
+	config.width = gc.width;
+	config.height = gc.height;
+	config.level_width = 4;
+	config.level_height = 4;
+	config.x = gc.x;
+	config.y = gc.y;
+	config.chaos = gc.chaos;
+	config.openness = gc.openness;
+	if (gc.world == WORLD_MIDDLE || gc.world == WORLD_BOTTOM)
+	{
+		config.floors = 3;
+		config.z = (gc.world == WORLD_MIDDLE) ? 1 : 2;
+	}
+	config.unbounded = (gc.world == WORLD_OPEN);
+	chunk c(config);
+	if (gc.pipe == PIPE_VIEW)
+	{
+		chunkcache_generate(c);
+		if (stairs) *stairs += count_stairs(c);
+		return c.hash();
+	}
+	c.generate_exits();
+	switch (gc.pipe)
+	{
+	case PIPE_BASIC:
+	case PIPE_CHUNKGEN_MAIN: chunk_filter_connect_exits(c); break;
+	case PIPE_CHUNKGEN_INNER: chunk_filter_connect_exits_inner_loop(c); break;
+	case PIPE_CHUNKGEN_GRAND: chunk_filter_connect_exits_grand_central(c); break;
+	}
+	const int iter = s.roll(2, 8);
+	chunk_filter_room_expand(c, iter, iter + 6);
+	chunk_filter_room_in_room(c);
+	chunk_filter_one_way_doors(c, s.roll(0, 4));
+	c.beautify();
+	room& r = chunk_filter_boss_placement(c, 0);
+	chunk_filter_protect_room(c, r);
+	chunk_filter_wildlife(c);
+	if (gc.pipe != PIPE_BASIC) chunk_filter_chest(c);
+	if (config.floors > 1) chunk_filter_stairs(c);
+	if (stairs) *stairs += count_stairs(c);
+	return c.hash();
+}
+
+// Identifies the random number generator, so that we can tell a changed generator from changed dice.
+static uint64_t dice_fingerprint()
+{
+	seed s(12345, 12345);
+	uint64_t h = 0;
+	for (int i = 0; i < 16; i++) h = h * 31 + s.roll(0, 1000000);
+	h = h * 31 + s.quadratic_weighted_roll(100);
+	seed d = s.derive(3, 2, 1);
+	for (int i = 0; i < 4; i++) h = h * 31 + d.roll(3, 29);
+	return h;
+}
+
+static bool write_table(const char* filename, const std::vector<golden_case>& cases, const std::vector<uint64_t>& hashes)
+{
+	FILE* fp = fopen(filename, "w");
+	if (!fp) return false;
+	fprintf(fp, "# Golden chunk hashes. Regenerate only for intentional output changes, with: golden_test --update <this file>\n");
+	fprintf(fp, "# pipeline world width height x y chaos openness seed hash\n");
+	fprintf(fp, "fingerprint %016" PRIx64 "\n", dice_fingerprint());
+	for (size_t i = 0; i < cases.size(); i++) fprintf(fp, "%s %016" PRIx64 "\n", cases[i].key().c_str(), hashes[i]);
+	return fclose(fp) == 0;
+}
+
+static bool read_table(const char* filename, uint64_t& fingerprint, std::map<std::string, uint64_t>& table)
+{
+	FILE* fp = fopen(filename, "r");
+	if (!fp) return false;
+	char line[256];
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (line[0] == '#' || line[0] == '\n') continue;
+		char* last = strrchr(line, ' ');
+		if (!last) continue;
+		*last = '\0';
+		const uint64_t value = strtoull(last + 1, nullptr, 16);
+		if (strcmp(line, "fingerprint") == 0) fingerprint = value;
+		else table[line] = value;
+	}
+	fclose(fp);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const bool update = (argc == 3 && strcmp(argv[1], "--update") == 0);
+	if (argc != 2 && !update)
+	{
+		printf("Usage: %s [--update] TABLE\n", argv[0]);
+		return 1;
+	}
+	const char* filename = argv[argc - 1];
+	const std::vector<golden_case> cases = matrix();
+
+	// Reference run, serial
+	std::vector<uint64_t> hashes(cases.size());
+	int stairs = 0;
+	for (size_t i = 0; i < cases.size(); i++) hashes[i] = generate(cases[i], &stairs);
+	if (stairs == 0)
+	{
+		printf("No case placed any stairs, so they are not covered!\n");
+		return 1;
+	}
+
+	if (update)
+	{
+		if (!write_table(filename, cases, hashes))
+		{
+			printf("Could not write %s!\n", filename);
+			return 1;
+		}
+		printf("Wrote %d hashes to %s\n", (int)cases.size(), filename);
+		return 0;
+	}
+
+	// Generation must not depend on anything but its inputs: run everything again on several threads at once
+	const int threads = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+	std::vector<uint64_t> parallel(cases.size());
+	std::vector<std::thread> pool;
+	for (int t = 0; t < threads; t++)
+	{
+		pool.emplace_back([&cases, &parallel, t, threads] { for (size_t i = t; i < cases.size(); i += threads) parallel[i] = generate(cases[i]); });
+	}
+	for (std::thread& t : pool) t.join();
+	int failures = 0;
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		if (parallel[i] != hashes[i])
+		{
+			printf("Nondeterministic: %s gave %016" PRIx64 " then %016" PRIx64 "\n", cases[i].key().c_str(), hashes[i], parallel[i]);
+			failures++;
+		}
+	}
+
+	uint64_t fingerprint = 0;
+	std::map<std::string, uint64_t> table;
+	if (!read_table(filename, fingerprint, table))
+	{
+		printf("No golden table at %s, so only determinism was checked. Record one with: %s --update %s\n", filename, argv[0], filename);
+		return failures ? 1 : 77; // skipped
+	}
+	if (fingerprint != dice_fingerprint())
+	{
+		printf("%s was recorded with different dice (libdicey %016" PRIx64 ", table %016" PRIx64 "), so its hashes cannot be compared.\n",
+		       filename, dice_fingerprint(), fingerprint);
+		printf("If the libdicey update is intended, regenerate the table with: %s --update %s\n", argv[0], filename);
+		return failures ? 1 : 77; // skipped
+	}
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		auto it = table.find(cases[i].key());
+		if (it == table.end())
+		{
+			printf("Missing from golden table: %s\n", cases[i].key().c_str());
+			failures++;
+		}
+		else if (it->second != hashes[i])
+		{
+			printf("Changed output: %s expected %016" PRIx64 " got %016" PRIx64 "\n", cases[i].key().c_str(), it->second, hashes[i]);
+			failures++;
+		}
+	}
+	printf("%d of %d golden chunks differ\n", failures, (int)cases.size());
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+#include "chunkgraph.h"
+#include <assert.h>
+
+#include <algorithm>
+#include <vector>
+
+static std::vector<bool> reach(int count, const std::vector<std::pair<int, int>>& edges, int from, bool directed)
+{
+	std::vector<bool> seen(count, false);
+	std::vector<int> todo = { from };
+	seen[from] = true;
+	while (!todo.empty())
+	{
+		const int n = todo.back();
+		todo.pop_back();
+		for (const auto& e : edges)
+		{
+			int next = -1;
+			if (e.first == n) next = e.second;
+			else if (!directed && e.second == n) next = e.first;
+			if (next != -1 && !seen[next]) { seen[next] = true; todo.push_back(next); }
+		}
+	}
+	return seen;
+}
+
+// Rooms that can be walked to from the top exit, going by tiles, must be exactly those the links reach from it
+static void links_test()
+{
+	int one_way = 0;
+	for (int value = 0; value < 40; value++)
+	{
+		seed s(value);
+		chunkconfig config(s);
+		config.level_width = 4;
+		config.level_height = 4;
+		config.x = 1;
+		config.y = 1;
+		chunk c(config);
+		chunkcache_generate(c);
+		const chunk_links l = chunk_room_links(c);
+		assert(l.rooms == (int)c.rooms.size());
+		assert(l.top != -1 && l.bottom != -1 && l.left != -1 && l.right != -1);
+		for (const auto& e : l.edges)
+		{
+			assert(e.first != e.second && e.first < l.rooms && e.second < l.rooms);
+			if (!std::binary_search(l.edges.begin(), l.edges.end(), std::make_pair(e.second, e.first))) one_way++;
+		}
+
+		std::vector<bool> tiles(c.width * c.height, false);
+		std::vector<std::pair<int, int>> todo = { { c.top, 0 } };
+		tiles[c.top] = true;
+		while (!todo.empty())
+		{
+			const auto p = todo.back();
+			todo.pop_back();
+			const int dx[4] = { 1, -1, 0, 0 };
+			const int dy[4] = { 0, 0, 1, -1 };
+			for (int i = 0; i < 4; i++)
+			{
+				const int x = p.first + dx[i];
+				const int y = p.second + dy[i];
+				if (x < 0 || y < 0 || x >= c.width || y >= c.height || c.rock(x, y) || tiles[y * c.width + x]) continue;
+				tiles[y * c.width + x] = true;
+				todo.push_back({ x, y });
+			}
+		}
+		const std::vector<bool> rooms = reach(l.rooms, l.edges, l.top, false);
+		for (const room& r : c.rooms)
+		{
+			bool walked = false;
+			for (int y = r.y1; y <= r.y2; y++) for (int x = r.x1; x <= r.x2; x++) walked = walked || tiles[y * c.width + x];
+			assert(walked == rooms[r.index]);
+		}
+	}
+	assert(one_way > 0);
+}
+
+// The graph of a view must cover every room it holds, connect neighbouring chunks, and only rescan what changed
+static void view_test()
+{
+	seed s(3);
+	chunkconfig c(s);
+	c.level_width = 6;
+	c.level_height = 6;
+	chunkview v(c, 64, 32);
+	roomgraph g;
+	seed walk(4);
+	int x = 40;
+	int y = 40;
+	for (int i = 0; i < 50; i++)
+	{
+		x = std::max(0, std::min(191, x + walk.roll(-20, 20)));
+		y = std::max(0, std::min(191, y + walk.roll(-20, 20)));
+		v.change_position(x, y);
+		g.update(v);
+		int rooms = 0;
+		int chunks = 0;
+		v.for_each_chunk([&](coords, const chunk& ch, int) { rooms += ch.rooms.size(); chunks++; });
+		assert(g.node_count() == rooms);
+		assert((int)g.offsets.size() == rooms + 1 && (int)g.offsets.back() == g.edge_count());
+		g.update(v);
+		assert(g.scanned == 0);
+
+		// Everything is connected through the exits
+		std::vector<std::pair<int, int>> edges;
+		for (int n = 0; n < g.node_count(); n++) for (const uint32_t* t = g.begin(n); t != g.end(n); t++) edges.emplace_back(n, *t);
+		v.for_each_chunk([&](coords cc, const chunk& ch, int)
+		{
+			const chunk_links l = chunk_room_links(ch);
+			const std::vector<bool> seen = reach(g.node_count(), edges, g.node(cc, l.top == -1 ? l.bottom : l.top), false);
+			v.for_each_chunk([&](coords other, const chunk& och, int)
+			{
+				const chunk_links ol = chunk_room_links(och);
+				if (ol.left != -1) assert(seen[g.node(other, ol.left)]);
+				if (ol.right != -1) assert(seen[g.node(other, ol.right)]);
+				(void)other;
+			});
+		});
+	}
+	assert(g.node({ 100, 100 }, 0) == -1);
+
+	// Changes made in place are noticed, even though the chunk objects stay the same
+	v.change_position(96, 96);
+	g.update(v);
+	v.set_tile(100, 100, v.get_tile(100, 100) == TILE_ROCK ? TILE_EMPTY : TILE_ROCK);
+	g.update(v);
+	assert(g.scanned == 1);
+	const int rerolled = v.reroll(64, 64, 127, 127, seed(5));
+	assert(rerolled > 0);
+	g.update(v);
+	assert(g.scanned > 0);
+	int rooms = 0;
+	v.for_each_chunk([&](coords, const chunk& ch, int) { rooms += ch.rooms.size(); });
+	assert(g.node_count() == rooms);
+	(void)rerolled;
+	(void)rooms;
+}
+
+int main()
+{
+	links_test();
+	view_test();
+	return 0;
+}
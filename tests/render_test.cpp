@@ -0,0 +1,182 @@
+#include "chunkrender.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// What print_room() used to print for every tile: a colour, the glyph, and a reset
+static void legacy_tile(std::string& out, uint8_t t)
+{
+	static const char* legacy[] = { " ", ".", "\x1b[0;36m'", "\x1b[0;36m+", "\x1b[0;36m^", "\x1b[0;36m_", "\x1b[0;36m[", "\x1b[0;36m]", "#",
+		"\x1b[0;90m#", "\x1b[0;90m*", "\x1b[0;34m.", "\x1b[0;91m§", "\x1b[0;91m¤", "\x1b[0;91mI", "\x1b[0;91m~", "\x1b[0;94mA", "\x1b[0;94mS",
+		"\x1b[0;94mG", "\x1b[0;32mt", "\x1b[0;93m&", "\x1b[0;91mB", "\x1b[0;91mL", "\x1b[0;92ms", "\x1b[0;94mT", "d", "\x1b[0;96mS", "\x1b[0;33mw" };
+	out.append(legacy[t]);
+	out.append("\x1b[0m");
+}
+
+static void legacy_room(std::string& out, const chunk& c, const room& r)
+{
+	for (int y = 0; y < c.height; y++)
+	{
+		for (int x = 0; x < c.width; x++)
+		{
+			const int t = c.at(x, y);
+			if (t == TILE_EMPTY && r.is_inside(x, y)) out.append("\x1b[0;33m");
+			legacy_tile(out, t);
+		}
+		out.push_back('\n');
+	}
+}
+
+// Play text with colour codes like a terminal would, giving what ends up in each cell
+[[maybe_unused]] static std::vector<std::string> screen(const std::string& s)
+{
+	std::vector<std::string> cells;
+	std::string colour = "0";
+	for (size_t i = 0; i < s.size();)
+	{
+		if (s[i] == '\x1b')
+		{
+			const size_t end = s.find('m', i);
+			assert(end != std::string::npos);
+			colour = s.substr(i + 2, end - i - 2);
+			i = end + 1;
+			continue;
+		}
+		size_t len = 1;
+		while (i + len < s.size() && (s[i + len] & 0xc0) == 0x80) len++; // rest of a UTF-8 character
+		cells.push_back(colour + ":" + s.substr(i, len));
+		i += len;
+	}
+	return cells;
+}
+
+static void generate(chunk& c)
+{
+	c.generate_exits();
+	chunk_filter_connect_exits(c);
+	chunk_filter_room_expand(c, 4, 10);
+	chunk_filter_room_in_room(c);
+	chunk_filter_one_way_doors(c, 2);
+	c.beautify();
+	room& r = chunk_filter_boss_placement(c, 0);
+	chunk_filter_protect_room(c, r);
+	chunk_filter_wildlife(c);
+	chunk_filter_chest(c);
+}
+
+// Coalesced colours must look exactly like colouring every tile on its own.
+static void ansi_test()
+{
+	for (int i = 0; i < 32; i++)
+	{
+		seed s(i);
+		chunkconfig config(s);
+		config.width = 64;
+		config.height = 32;
+		chunk c(config);
+		generate(c);
+		const room& r = c.rooms.at(i % c.rooms.size());
+		std::string legacy;
+		legacy_room(legacy, c, r);
+		std::string now;
+		chunk_render(now, c, RENDER_ANSI, &r);
+		assert(screen(legacy) == screen(now));
+		assert(now.size() < legacy.size());
+	}
+}
+
+static void image_test()
+{
+	seed s(5);
+	chunkconfig config(s);
+	config.width = 64;
+	config.height = 32;
+	chunk c(config);
+	generate(c);
+
+	std::string ascii;
+	chunk_render(ascii, c, RENDER_ASCII);
+	assert(ascii.size() == (size_t)(c.width + 1) * c.height);
+	for (int y = 0; y < c.height; y++) for (int x = 0; x < c.width; x++) assert((c.at(x, y) == TILE_WALL || c.at(x, y) == TILE_WALL_DAMAGED) == (ascii[y * (c.width + 1) + x] == '#'));
+
+	std::string ppm;
+	chunk_render(ppm, c, RENDER_PPM);
+	const char* header = "P6\n64 32\n255\n";
+	assert(ppm.compare(0, strlen(header), header) == 0);
+	assert(ppm.size() == strlen(header) + 64 * 32 * 3);
+	uint8_t rgb[3];
+	chunk_render_rgb(c.at(10, 7), rgb);
+	assert(memcmp(&ppm[strlen(header) + (7 * 64 + 10) * 3], rgb, 3) == 0);
+
+	std::string pgm;
+	chunk_render(pgm, c, RENDER_PGM);
+	assert(pgm.compare(0, 3, "P5\n") == 0);
+	assert(pgm.size() == strlen(header) + 64 * 32);
+	assert((uint8_t)pgm[strlen(header)] == 0); // corners are always rock
+	(void)header;
+}
+
+// A level image must be the chunk images put side by side, whatever the number of threads.
+static void level_test()
+{
+	seed s(9);
+	chunkconfig config(s);
+	config.width = 32;
+	config.height = 32;
+	config.level_width = 5;
+	config.level_height = 3;
+	const int scale = 2;
+	for (int threads = 1; threads <= 4; threads += 3)
+	{
+		FILE* fp = tmpfile();
+		assert(fp);
+		const bool rendered = chunk_render_level(fp, config, generate, RENDER_PGM, scale, threads);
+		assert(rendered);
+		(void)rendered;
+		const long size = ftell(fp);
+		rewind(fp);
+		std::string image(size, '\0');
+		const size_t got = fread(&image[0], 1, size, fp);
+		assert(got == (size_t)size);
+		(void)got;
+		fclose(fp);
+		const char* header = "P5\n320 192\n255\n";
+		assert(image.compare(0, strlen(header), header) == 0);
+		assert(image.size() == strlen(header) + 320 * 192);
+		const uint8_t* pixels = (const uint8_t*)image.data() + strlen(header);
+		for (int cy = 0; cy < config.level_height; cy++)
+		{
+			for (int cx = 0; cx < config.level_width; cx++)
+			{
+				chunkconfig cc = config;
+				cc.x = cx;
+				cc.y = cy;
+				chunk c(cc);
+				generate(c);
+				std::string pgm;
+				chunk_render(pgm, c, RENDER_PGM);
+				const uint8_t* tiles = (const uint8_t*)pgm.data() + pgm.size() - 32 * 32;
+				for (int y = 0; y < 32 * scale; y++)
+				{
+					for (int x = 0; x < 32 * scale; x++)
+					{
+						assert(pixels[(cy * 32 * scale + y) * 320 + cx * 32 * scale + x] == tiles[(y / scale) * 32 + x / scale]);
+					}
+				}
+				(void)tiles;
+			}
+		}
+		(void)pixels;
+	}
+}
+
+int main()
+{
+	ansi_test();
+	image_test();
+	level_test();
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include "chunksearch.h"
+#include <assert.h>
+#include <stdio.h>
+
+#include <vector>
+
+static chunkconfig make_config(uint64_t value)
+{
+	seed s(value, value);
+	chunkconfig config(s);
+	config.width = 64;
+	config.height = 32;
+	config.level_width = 4;
+	config.level_height = 4;
+	config.x = 1;
+	config.y = 1;
+	config.chaos = s.roll(0, 4);
+	config.openness = s.roll(0, 4);
+	return config;
+}
+
+// The same steps as in chunkgen.cpp, in one go
+static uint64_t chunkgen_hash(uint64_t value, int method)
+{
+	chunk c(make_config(value));
+	seed s = c.config.state;
+	c.generate_exits();
+	if (method == 2) chunk_filter_connect_exits_grand_central(c);
+	else if (method == 1) chunk_filter_connect_exits_inner_loop(c);
+	else chunk_filter_connect_exits(c);
+	const int iter = s.roll(2, 8);
+	chunk_filter_room_expand(c, iter, iter + 6);
+	chunk_filter_room_in_room(c);
+	chunk_filter_one_way_doors(c, s.roll(0, 4));
+	c.beautify();
+	room& r = chunk_filter_boss_placement(c, 0);
+	chunk_filter_protect_room(c, r);
+	chunk_filter_wildlife(c);
+	chunk_filter_chest(c);
+	return c.hash();
+}
+
+// Seeds found by search must give the same chunks as chunkgen gives for them.
+static void pipeline_test()
+{
+	for (int method = 0; method < 3; method++)
+	{
+		const search_pipeline pipeline = search_pipeline_chunkgen(method);
+		for (uint64_t value = 0; value < 32; value++)
+		{
+			chunk c(make_config(value));
+			bool ok = true;
+			for (int stage = 0; stage < SEARCH_STAGES; stage++) ok = pipeline(c, stage) && ok;
+			const bool same = c.hash() == chunkgen_hash(value, method);
+			assert(ok && same);
+			(void)same;
+		}
+	}
+}
+
+static std::vector<search_predicate> predicates()
+{
+	return {
+		{ SEARCH_SKELETON, [](const chunk& c) { return chunk_skeleton_layout(c) == 2; } },
+		{ SEARCH_POPULATED, [](const chunk& c) { const room* r = chunk_boss_room(c); return r && r->size() >= 20; } },
+	};
+}
+
+// Results must not depend on the number of threads, and must be the lowest matching seeds.
+static void search_test()
+{
+	const std::vector<search_predicate> preds = predicates();
+	search_options options;
+	options.count = 400;
+	options.max_matches = 5;
+	options.threads = 1;
+	const search_result serial = seed_search(make_config, search_pipeline_chunkgen(0), preds, options);
+	options.threads = 8;
+	const search_result parallel = seed_search(make_config, search_pipeline_chunkgen(0), preds, options);
+	assert(serial.matches.size() == 5);
+	assert(serial.matches == parallel.matches);
+	assert(serial.evaluated == serial.matches.back() + 1); // stopped right at the last match
+	assert(parallel.evaluated >= serial.evaluated);
+
+	// Check against brute force
+	std::vector<uint64_t> expected;
+	for (uint64_t value = 0; expected.size() < 5; value++)
+	{
+		chunk c(make_config(value));
+		const search_pipeline pipeline = search_pipeline_chunkgen(0);
+		bool ok = true;
+		for (int stage = 0; stage < SEARCH_STAGES; stage++)
+		{
+			pipeline(c, stage);
+			for (const search_predicate& p : preds) if (p.stage == stage && ok) ok = p.test(c);
+		}
+		if (ok) expected.push_back(value);
+	}
+	assert(expected == serial.matches);
+
+	// The layout predicate should reject most seeds before rooms are made
+	assert(serial.rejected[SEARCH_SKELETON] > serial.rejected[SEARCH_POPULATED]);
+	assert(serial.rejected[SEARCH_ROOMS] == 0);
+	assert(serial.rejected[SEARCH_SKELETON] + serial.rejected[SEARCH_POPULATED] + 5 == serial.evaluated);
+	printf("Found %d seeds in %llu tries, %.1f seeds/s\n", (int)serial.matches.size(), (unsigned long long)parallel.evaluated, parallel.evaluated / parallel.seconds);
+}
+
+// Asking for more than exist stops at the end of the range.
+static void exhaust_test()
+{
+	search_options options;
+	options.first = 1000;
+	options.count = 50;
+	options.max_matches = 1000;
+	options.threads = 4;
+	const search_result r = seed_search(make_config, search_pipeline_chunkgen(0), predicates(), options);
+	assert(r.evaluated == 50);
+	assert((int)r.matches.size() < 50);
+	for (uint64_t value : r.matches)
+	{
+		assert(value >= 1000 && value < 1050);
+		(void)value;
+	}
+}
+
+int main()
+{
+	pipeline_test();
+	search_test();
+	exhaust_test();
+	return 0;
+}
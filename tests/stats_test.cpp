@@ -0,0 +1,70 @@
+// Built with CHUNKY_STATS defined
+#include "chunkcache.h"
+#include <assert.h>
+#include <stdio.h>
+
+#include <thread>
+#include <vector>
+
+int main()
+{
+	chunkstats total;
+	for (int i = 0; i < 64; i++)
+	{
+		seed s(i);
+		chunkconfig config(s);
+		config.width = 64;
+		config.height = 64;
+		config.level_width = 4;
+		config.level_height = 4;
+		config.x = s.roll(0, config.level_width - 1);
+		config.y = s.roll(0, config.level_height - 1);
+		chunk c(config);
+		c.generate_exits();
+		chunk_filter_connect_exits(c);
+		chunk_filter_room_expand(c, 3, 9);
+		chunk_filter_room_in_room(c);
+		chunk_filter_one_way_doors(c, 2);
+		c.beautify();
+		room& r = chunk_filter_boss_placement(c, 0);
+		chunk_filter_protect_room(c, r);
+		chunk_filter_wildlife(c);
+		chunk_filter_chest(c);
+
+		assert(c.stats.rock_probes > 0);
+		assert(c.stats.digs > 0);
+		assert(c.stats.rolls > 0);
+		assert(c.stats.can_build_scans > 0);
+		assert(c.stats.grow_failures <= c.stats.grow_attempts);
+		assert(c.stats.stage_calls[STAGE_GENERATE_EXITS] == 1);
+		assert(c.stats.stage_calls[STAGE_CONNECT_EXITS] == 1);
+		assert(c.stats.stage_calls[STAGE_ROOM_EXPAND] == 1);
+		assert(c.stats.stage_calls[STAGE_BEAUTIFY] == 1);
+		assert(c.stats.stage_calls[STAGE_CHEST] == 1);
+		assert(c.stats.stage_ns[STAGE_ROOM_EXPAND] > 0);
+
+		// Copies carry their statistics with them
+		chunk copy = c;
+		assert(copy.stats.digs == c.stats.digs);
+		total += c.stats;
+	}
+	assert(total.stage_calls[STAGE_CONNECT_EXITS] == 64);
+	total.print();
+
+	// Chunks handed out by a cache are read from many threads, so only their generation is counted
+	seed s(3);
+	chunkconfig config(s);
+	chunkcache cache(config);
+	chunkpin skeleton = cache.pin({ 1, 1 }, DETAIL_SKELETON);
+	skeleton.release();
+	chunkpin p = cache.pin({ 1, 1 });
+	const chunk& c = *p;
+	const chunkstats generated = c.stats;
+	assert(c.stats_shared && generated.stage_calls[STAGE_GENERATE_EXITS] == 1 && generated.stage_calls[STAGE_ROOM_EXPAND] == 1);
+	std::vector<std::thread> pool;
+	for (int i = 0; i < 4; i++) pool.emplace_back([&c] { int n = 0; for (int y = 0; y < c.height; y++) for (int x = 0; x < c.width; x++) n += c.rock(x, y); (void)n; });
+	for (std::thread& t : pool) t.join();
+	assert(c.stats.rock_probes == generated.rock_probes);
+	(void)generated;
+	return 0;
+}
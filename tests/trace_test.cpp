@@ -0,0 +1,80 @@
+#include "chunkcache.h"
+#include "chunkview.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string read_file(const char* filename)
+{
+	std::string content;
+	FILE* fp = fopen(filename, "r");
+	assert(fp);
+	if (!fp) return content;
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) content.append(buf, len);
+	fclose(fp);
+	return content;
+}
+
+[[maybe_unused]] static int count(const std::string& haystack, const char* needle)
+{
+	int n = 0;
+	for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) n++;
+	return n;
+}
+
+int main()
+{
+	const char* filename = "trace_test.json";
+	seed s(5);
+	chunkconfig config(s);
+	config.level_width = 8;
+	config.level_height = 8;
+
+	// Nothing is recorded unless started
+	{
+		chunk c(config);
+		chunkcache_generate(c);
+	}
+	assert(chunk_trace_event_count() == 0);
+
+	chunk_trace_start();
+	chunkcache cache(config);
+	std::vector<std::thread> pool;
+	for (int i = 0; i < 4; i++)
+	{
+		pool.emplace_back([&cache, i] { chunkview v(cache, 64, 32); v.change_position(i * 64, i * 32); });
+	}
+	for (std::thread& t : pool) t.join();
+	chunk_trace_stop();
+	const size_t events = chunk_trace_event_count();
+	assert(events > 0);
+	{
+		chunk c(config);
+		chunkcache_generate(c);
+	}
+	assert(chunk_trace_event_count() == events);
+	(void)events;
+
+	const bool written = chunk_trace_write(filename);
+	assert(written);
+	(void)written;
+	const std::string json = read_file(filename);
+	assert(json.find("\"traceEvents\"") != std::string::npos);
+	assert(count(json, "\"ph\":\"B\"") == count(json, "\"ph\":\"E\""));
+	assert(count(json, "\"ph\":\"B\"") * 2 == (int)events);
+	assert(count(json, "\"name\":\"generate chunk\"") == (int)cache.generated());
+	assert(count(json, "\"name\":\"chunk_filter_room_expand\"") == (int)cache.generated());
+	assert(count(json, "\"name\":\"thread_name\"") >= 4);
+	assert(json.find("\"args\":{\"seed\":\"5\"") != std::string::npos);
+
+	chunk_trace_clear();
+	assert(chunk_trace_event_count() == 0);
+	remove(filename);
+	return 0;
+}
@@ -1,9 +1,624 @@
 #include "chunkview.h"
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
+#include <vector>
+
+// Generating a chunk in steps must give the same result as doing it in one go.
+static void staged_generation_test()
+{
+	for (int i = 0; i < 64; i++)
+	{
+		seed s(i);
+		chunkconfig config(s);
+		config.x = s.roll(0, config.level_width - 1);
+		config.y = s.roll(0, config.level_height - 1);
+		chunk oneshot(config);
+		chunkcache_generate(oneshot);
+		chunk staged(config);
+		chunkcache_generate(staged, DETAIL_NONE, DETAIL_SKELETON);
+		chunkcache_generate(staged, DETAIL_SKELETON, DETAIL_ROOMS);
+		chunkcache_generate(staged, DETAIL_ROOMS, DETAIL_FULL);
+		assert(oneshot.rooms.size() == staged.rooms.size());
+		assert(oneshot.entities.size() == staged.entities.size());
+		for (int y = 0; y < oneshot.height; y++) for (int x = 0; x < oneshot.width; x++) assert(oneshot.at(x, y) == staged.at(x, y));
+	}
+}
+
+static void lod_view_test()
+{
+	seed s(7);
+	chunkconfig c(s);
+	c.level_width = 8;
+	c.level_height = 8;
+	chunkview v(c, 64, 32);
+	v.set_skeleton_margin(2);
+	v.set_rooms_margin(1);
+	v.change_position(0, 0);
+	v.self_test();
+	assert(v.chunk_detail(0, 0) == DETAIL_FULL);
+	assert(v.chunk_detail(32, 32) == DETAIL_ROOMS);
+	assert(v.chunk_detail(32 * 2, 0) == DETAIL_SKELETON);
+	assert(v.chunk_detail(32 * 3, 0) == DETAIL_NONE);
+	auto chunk_at = [&v](coords cc) { const chunk* found = nullptr; v.for_each_chunk([&](coords at, const chunk& ch, int) { if (at == cc) found = &ch; }); return found; };
+	const chunk* skeleton = chunk_at({ 2, 0 });
+
+	// Walk to the right, upgrading skeleton chunks to rooms and then to full detail as they come closer
+	for (int x = 0; x < 32 * 5; x += 8)
+	{
+		v.change_position(x, 16);
+		v.self_test();
+	}
+	assert(v.chunk_detail(32 * 4, 0) == DETAIL_FULL);
+	assert(chunk_at({ 2, 0 }) == skeleton); // nobody else held it, so it was upgraded in place
+	(void)skeleton;
+
+	// Upgraded chunks must look exactly like those generated in one go
+	for (int cx = 0; cx < 5; cx++)
+	{
+		chunkconfig fresh = c;
+		fresh.x = cx;
+		fresh.y = 0;
+		chunk oneshot(fresh);
+		chunkcache_generate(oneshot);
+		for (int y = 0; y < oneshot.height; y++) for (int x = 0; x < oneshot.width; x++) assert(v.get_tile(cx * 32 + x, y) == oneshot.at(x, y));
+	}
+}
+
+// Keeps a copy of the view up to date from the changes alone, like a runner redrawing only what changed.
+struct shadow_view
+{
+	std::vector<int> cells;
+	int width;
+	int height;
+
+	void refetch(const chunkview& v, int x1, int y1, int x2, int y2)
+	{
+		for (int y = std::max(0, y1); y <= std::min(height - 1, y2); y++)
+			for (int x = std::max(0, x1); x <= std::min(width - 1, x2); x++)
+				cells[y * width + x] = v.get_tile(v.view_x() + x, v.view_y() + y);
+	}
+
+	void update(chunkview& v)
+	{
+		const chunkview_changes ch = v.take_changes();
+		if (ch.full || abs(ch.scroll_x) >= width || abs(ch.scroll_y) >= height)
+		{
+			refetch(v, 0, 0, width - 1, height - 1);
+			return;
+		}
+		std::vector<int> old = cells;
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				const int ox = x + ch.scroll_x;
+				const int oy = y + ch.scroll_y;
+				if (ox >= 0 && ox < width && oy >= 0 && oy < height) cells[y * width + x] = old[oy * width + ox];
+			}
+		}
+		if (ch.scroll_x > 0) refetch(v, width - ch.scroll_x, 0, width - 1, height - 1);
+		if (ch.scroll_x < 0) refetch(v, 0, 0, -ch.scroll_x - 1, height - 1);
+		if (ch.scroll_y > 0) refetch(v, 0, height - ch.scroll_y, width - 1, height - 1);
+		if (ch.scroll_y < 0) refetch(v, 0, 0, width - 1, -ch.scroll_y - 1);
+		for (const coords& t : ch.tiles) refetch(v, t.x - v.view_x(), t.y - v.view_y(), t.x - v.view_x(), t.y - v.view_y());
+		for (const coords& c : ch.chunks)
+		{
+			const int x1 = c.x * v.chunk_width() - v.view_x();
+			const int y1 = c.y * v.chunk_height() - v.view_y();
+			refetch(v, x1, y1, x1 + v.chunk_width() - 1, y1 + v.chunk_height() - 1);
+		}
+	}
+};
+
+static void changes_test()
+{
+	seed s(11);
+	chunkconfig c(s);
+	c.level_width = 8;
+	c.level_height = 8;
+	chunkview v(c, 40, 20);
+	v.change_position(50, 50);
+	chunkview_changes ch = v.take_changes();
+	assert(ch.full);
+	v.change_position(53, 48);
+	ch = v.take_changes();
+	assert(!ch.full && ch.scroll_x == 3 && ch.scroll_y == -2);
+	v.set_tile(53, 48, TILE_DEBRIS);
+	v.set_tile(0, 0, TILE_DEBRIS); // out of view
+	ch = v.take_changes();
+	assert(ch.tiles.size() == 1 && ch.tiles[0].x == 53 && ch.tiles[0].y == 48);
+	v.change_position(53 + 32 * 2, 48);
+	ch = v.take_changes();
+	assert(ch.scroll_x == 64 && !ch.chunks.empty());
+
+	// Random walk with edits; the shadow must always match the view
+	shadow_view sh = { std::vector<int>(40 * 20, -1), 40, 20 };
+	seed walk(12);
+	int x = 100;
+	int y = 100;
+	v.take_changes();
+	sh.refetch(v, 0, 0, 39, 19);
+	for (int i = 0; i < 500; i++)
+	{
+		const int step = walk.roll(0, 9) == 0 ? 30 : 2;
+		x = std::max(0, std::min(255, x + walk.roll(-step, step)));
+		y = std::max(0, std::min(255, y + walk.roll(-step, step)));
+		v.change_position(x, y);
+		if (walk.roll(0, 1)) v.set_tile(x + walk.roll(-25, 25), y + walk.roll(-12, 12), TILE_DEBRIS);
+		sh.update(v);
+		for (int yy = 0; yy < 20; yy++) for (int xx = 0; xx < 40; xx++) assert(sh.cells[yy * 40 + xx] == v.get_tile(v.view_x() + xx, v.view_y() + yy));
+	}
+}
+
+// The viewport buffer must always hold what get_tile() gives, also partly outside the level.
+static void viewport_test()
+{
+	seed s(13);
+	chunkconfig c(s);
+	c.level_width = 4;
+	c.level_height = 4;
+	chunkview v(c, 50, 30);
+	seed walk(14);
+	int x = 0;
+	int y = 0;
+	for (int i = 0; i < 400; i++)
+	{
+		const int step = walk.roll(0, 9) == 0 ? 60 : 3;
+		x = std::max(-40, std::min(170, x + walk.roll(-step, step)));
+		y = std::max(-40, std::min(170, y + walk.roll(-step, step)));
+		v.change_position(x, y);
+		v.set_tile(x + walk.roll(-30, 30), y + walk.roll(-20, 20), TILE_DEBRIS);
+		const viewport_span vp = v.viewport();
+		assert(vp.width == 50 && vp.height == 30 && vp.x == v.view_x() && vp.y == v.view_y());
+		for (int yy = 0; yy < vp.height; yy++) for (int xx = 0; xx < vp.width; xx++) assert(vp.at(xx, yy) == v.get_tile(vp.x + xx, vp.y + yy));
+	}
+}
+
+[[maybe_unused]] static uint8_t mip_brute_force(const chunkview& v, int level, int64_t x, int64_t y)
+{
+	const int64_t size = 1 << level;
+	const int64_t x1 = x - (x % size);
+	const int64_t y1 = y - (y % size);
+	uint8_t flags = 0;
+	for (int64_t yy = y1; yy < y1 + size; yy++) for (int64_t xx = x1; xx < x1 + size; xx++)
+	{
+		const tile_type t = v.get_tile(xx, yy);
+		if (t == TILE_WALL || t == TILE_WALL_DAMAGED) flags |= MIP_WALL;
+		else if (t != TILE_ROCK) flags |= MIP_OPEN;
+		if (t == TILE_DOOR_OPEN || t == TILE_DOOR_CLOSED || (t >= TILE_ONE_WAY_TOP && t <= TILE_ONE_WAY_RIGHT)) flags |= MIP_DOOR;
+	}
+	return flags;
+}
+
+// The mip pyramid must summarize exactly the tiles below it, also after we change them.
+static void mip_test()
+{
+	seed s(17);
+	chunkconfig c(s);
+	c.level_width = 4;
+	c.level_height = 4;
+	chunkview v(c, 40, 20);
+	seed walk(18);
+	const tile_type edits[] = { TILE_ROCK, TILE_WALL, TILE_DOOR_CLOSED, TILE_EMPTY, TILE_ONE_WAY_LEFT };
+	int x = 20;
+	int y = 10;
+	for (int i = 0; i < 100; i++)
+	{
+		x = std::max(0, std::min(127, x + walk.roll(-8, 8)));
+		y = std::max(0, std::min(127, y + walk.roll(-8, 8)));
+		v.change_position(x, y);
+		for (int j = 0; j < 10; j++) v.set_tile(x + walk.roll(-20, 19), y + walk.roll(-10, 9), edits[walk.roll(0, 4)]);
+		for (int level = 1; level <= chunkmip::LEVELS; level++)
+		{
+			for (int64_t yy = v.view_y(); yy < v.view_y() + 20; yy++) for (int64_t xx = v.view_x(); xx < v.view_x() + 40; xx++)
+			{
+				if (v.chunk_detail(xx, yy) == DETAIL_NONE) continue;
+				assert(v.get_mip(level, xx, yy) == mip_brute_force(v, level, xx, yy));
+			}
+		}
+	}
+	assert(v.get_mip(1, -10, -10) == 0);
+}
+
+// Feature queries must find exactly the tiles that a scan finds, also after changes and packing.
+static void features_test()
+{
+	seed s(19);
+	chunkconfig c(s);
+	c.level_width = 6;
+	c.level_height = 6;
+	chunkview v(c, 40, 20);
+	v.set_pack_margin(0);
+	seed walk(20);
+	const tile_type edits[] = { TILE_DOOR_OPEN, TILE_ONE_WAY_TOP, TILE_WALL, TILE_CHEST, ENTITY_WILD, TILE_EMPTY };
+	int x = 20;
+	int y = 10;
+	std::vector<coords> found;
+	for (int i = 0; i < 200; i++)
+	{
+		const int step = walk.roll(0, 9) == 0 ? 60 : 4;
+		x = std::max(0, std::min(191, x + walk.roll(-step, step)));
+		y = std::max(0, std::min(191, y + walk.roll(-step, step)));
+		v.change_position(x, y);
+		for (int j = 0; j < 5; j++) v.set_tile(x + walk.roll(-20, 19), y + walk.roll(-10, 9), edits[walk.roll(0, 5)]);
+		const int64_t x1 = v.view_x() + walk.roll(0, 20);
+		const int64_t y1 = v.view_y() + walk.roll(0, 10);
+		const int64_t x2 = x1 + walk.roll(0, 19);
+		const int64_t y2 = y1 + walk.roll(0, 9);
+		for (int f = FEATURE_NONE + 1; f < FEATURE_TYPES; f++)
+		{
+			found.clear();
+			v.find_features(f, x1, y1, x2, y2, found);
+			size_t expected = 0;
+			for (int64_t yy = y1; yy <= y2; yy++) for (int64_t xx = x1; xx <= x2; xx++) if (v.chunk_detail(xx, yy) != DETAIL_NONE && tile_feature(v.get_tile(xx, yy)) == f) expected++;
+			assert(found.size() == expected);
+			for (const coords& cc : found)
+			{
+				assert(cc.x >= x1 && cc.x <= x2 && cc.y >= y1 && cc.y <= y2 && tile_feature(v.get_tile(cc.x, cc.y)) == f);
+				(void)cc;
+			}
+		}
+	}
+	assert(v.cache().packing().inflations > 0);
+
+	chunk ch(c);
+	ch.generate_exits();
+	chunk_filter_connect_exits(ch);
+	ch.build(5, 5, TILE_TRAP);
+	assert(ch.count_features(FEATURE_INTERACTABLE, 0, 0, ch.width - 1, ch.height - 1) == 1);
+	assert(ch.count_features(FEATURE_INTERACTABLE, 6, 0, ch.width - 1, ch.height - 1) == 0);
+	ch.self_test();
+}
+
+// Entity queries must find exactly what scanning the entity lists of the chunks in view finds.
+static void entities_test()
+{
+	seed s(21);
+	chunkconfig c(s);
+	c.level_width = 8;
+	c.level_height = 8;
+	chunkcache cache(c);
+	chunkview v(cache, 64, 32);
+	v.set_pack_margin(0);
+	seed walk(22);
+	int x = 30;
+	int y = 20;
+	std::vector<chunkview_entity> found;
+	int seen = 0;
+	for (int i = 0; i < 200; i++)
+	{
+		const int step = walk.roll(0, 9) == 0 ? 80 : 6;
+		x = std::max(0, std::min(255, x + walk.roll(-step, step)));
+		y = std::max(0, std::min(255, y + walk.roll(-step, step)));
+		v.change_position(x, y);
+		v.self_test();
+		const int64_t qx = x + walk.roll(-30, 30);
+		const int64_t qy = y + walk.roll(-15, 15);
+		const int64_t radius = walk.roll(0, 24);
+		found.clear();
+		v.entities_in_radius(qx, qy, radius, found);
+		size_t expected = 0;
+		for (int64_t cy = v.view_y() / 32; cy <= (v.view_y() + 31) / 32; cy++) for (int64_t cx = v.view_x() / 32; cx <= (v.view_x() + 63) / 32; cx++)
+		{
+			if (cx < 0 || cy < 0 || cx >= c.level_width || cy >= c.level_height) continue;
+			const chunkpin ch = cache.find({cx, cy});
+			for (const entity& e : ch->entities)
+			{
+				const int64_t ex = cx * 32 + e.x;
+				const int64_t ey = cy * 32 + e.y;
+				if ((ex - qx) * (ex - qx) + (ey - qy) * (ey - qy) <= radius * radius) expected++;
+				int in_room = 0;
+				for (const chunkview_entity& we : v.room_entities({cx, cy}, e.room_index)) in_room += (we.x == ex && we.y == ey && we.type == e.type);
+				assert(in_room == 1);
+			}
+		}
+		assert(found.size() == expected);
+		seen += found.size();
+		for (const chunkview_entity& we : found)
+		{
+			assert(v.get_tile(we.x, we.y) == we.type);
+			(void)we;
+		}
+	}
+	assert(seen > 0);
+	assert(v.room_entities({100, 100}, 0).empty());
+}
+
+// Rerolling rooms through the view must keep its viewport and entity index right.
+static void reroll_test()
+{
+	seed s(23);
+	chunkconfig c(s);
+	c.level_width = 4;
+	c.level_height = 4;
+	chunkview v(c, 64, 32);
+	v.set_skeleton_margin(1);
+	v.change_position(60, 60);
+	v.take_changes();
+	std::vector<uint64_t> margin; // chunks below full detail are not furnished yet, and must be left alone
+	v.for_each_chunk([&](coords, const chunk& ch, int detail) { if (detail < DETAIL_FULL) margin.push_back(ch.hash()); });
+	assert(!margin.empty());
+	const int rerolled = v.reroll(-1000, -1000, 1000, 1000, seed(24));
+	assert(rerolled > 0);
+	size_t next = 0;
+	v.for_each_chunk([&](coords, const chunk& ch, int detail) { if (detail < DETAIL_FULL) { assert(ch.hash() == margin.at(next)); next++; } });
+	assert(next == margin.size());
+	v.self_test();
+	const chunkview_changes changes = v.take_changes();
+	assert(changes.full || !changes.tiles.empty());
+	std::vector<chunkview_entity> found;
+	v.entities_in_rect(v.view_x(), v.view_y(), v.view_x() + 63, v.view_y() + 31, found);
+	for (const chunkview_entity& we : found)
+	{
+		assert(v.get_tile(we.x, we.y) == we.type);
+		(void)we;
+	}
+	const int outside = v.reroll(-100, -100, -50, -50, seed(24));
+	assert(outside == 0);
+	(void)rerolled;
+	(void)outside;
+}
+
+// A view that packs chunks it walks away from must show exactly what a view that keeps them does,
+// including tiles we changed before walking away.
+static void pack_test()
+{
+	seed s(15);
+	chunkconfig c(s);
+	c.level_width = 8;
+	c.level_height = 8;
+	chunkview plain(c, 40, 20);
+	chunkview packing(c, 40, 20);
+	packing.set_pack_margin(0);
+	seed walk(16);
+	int x = 20;
+	int y = 10;
+	std::vector<coords> edits;
+	for (int i = 0; i < 300; i++)
+	{
+		const int step = walk.roll(0, 9) == 0 ? 60 : 4;
+		x = std::max(0, std::min(255, x + walk.roll(-step, step)));
+		y = std::max(0, std::min(255, y + walk.roll(-step, step)));
+		plain.change_position(x, y);
+		packing.change_position(x, y);
+		const coords e = { x + walk.roll(-20, 19), y + walk.roll(-10, 9) };
+		plain.set_tile(e.x, e.y, TILE_DEBRIS);
+		packing.set_tile(e.x, e.y, TILE_DEBRIS);
+		edits.push_back(e);
+		packing.self_test();
+		for (int yy = 0; yy < 20; yy++) for (int xx = 0; xx < 40; xx++) assert(plain.get_tile(plain.view_x() + xx, plain.view_y() + yy) == packing.get_tile(packing.view_x() + xx, packing.view_y() + yy));
+	}
+	const chunkcache_packing before = packing.cache().packing();
+	assert(before.packed > 0 && before.ratio() > 1.0);
+	assert(plain.cache().packing().packed == 0);
+	for (const coords& e : edits)
+	{
+		assert(packing.get_tile(e.x, e.y) == plain.get_tile(e.x, e.y)); // unpacks on access
+		(void)e;
+	}
+	assert(packing.cache().packing().inflations > before.inflations);
+	(void)before;
+}
+
+// Neighbouring chunks must agree on their shared exits anywhere in an unbounded world, and a view walking
+// across it must keep its cache within budget.
+static void unbounded_test()
+{
+	seed s(17);
+	chunkconfig c(s);
+	c.unbounded = true;
+	const int64_t places[][2] = { { 0, 0 }, { -1, -1 }, { -5, 3 }, { 2147483646, -2147483649ll }, { 1ll << 40, -(1ll << 50) }, { INT64_MAX / 64, INT64_MIN / 64 } };
+	for (const auto& place : places)
+	{
+		for (int64_t dy = 0; dy < 2; dy++)
+		{
+			for (int64_t dx = 0; dx < 2; dx++)
+			{
+				chunkconfig here = c;
+				here.x = place[0] + dx;
+				here.y = place[1] + dy;
+				chunkconfig right = here;
+				right.x++;
+				chunkconfig below = here;
+				below.y++;
+				chunk a(here), b(right), d(below);
+				a.generate_exits();
+				b.generate_exits();
+				d.generate_exits();
+				assert(a.top != -1 && a.left != -1 && a.right != -1 && a.bottom != -1);
+				assert(a.right == b.left && a.bottom == d.top);
+			}
+		}
+	}
+
+	chunkview v(c, 64, 32);
+	const size_t budget = v.cache().budget();
+	assert(budget > 0);
+	int64_t x = -(1ll << 45);
+	int64_t y = 1ll << 45;
+	for (int i = 0; i < 200; i++)
+	{
+		x += 40;
+		y -= (i % 3) * 10;
+		v.change_position(x, y);
+		v.set_tile(x, y, TILE_DEBRIS);
+		const viewport_span vp = v.viewport();
+		assert(vp.x == x - 32 && vp.y == y - 16 && vp.at(32, 16) == TILE_DEBRIS);
+		assert(v.chunk_detail(x, y) == DETAIL_FULL);
+		assert(v.cache().size() <= budget);
+		(void)vp;
+	}
+	(void)budget;
+	v.self_test();
+	assert(v.cache().evicted() > 0);
+}
+
+[[maybe_unused]] static int count_entities(const chunk& c, int type)
+{
+	int n = 0;
+	for (const entity& e : c.entities) n += (e.type == type);
+	return n;
+}
+
+// Every floor is its own level, with stairs that both ends agree on, and the top floor is what a
+// single floor level would be apart from its stairs.
+static void floors_test()
+{
+	seed s(18);
+	chunkconfig c(s);
+	c.level_width = 4;
+	c.level_height = 4;
+	c.floors = 3;
+	int links = 0;
+	for (int z = 0; z < c.floors; z++)
+	{
+		for (int y = 0; y < c.level_height; y++)
+		{
+			for (int x = 0; x < c.level_width; x++)
+			{
+				chunkconfig here = c;
+				here.x = x;
+				here.y = y;
+				here.z = z;
+				chunk ch(here);
+				chunkcache_generate(ch);
+				assert(count_entities(ch, TILE_STAIRS_DOWN) == (int)c.stairs(x, y, z));
+				assert(count_entities(ch, TILE_STAIRS_UP) == (int)c.stairs(x, y, z - 1));
+				links += c.stairs(x, y, z);
+				if (z == 0)
+				{
+					chunkconfig single = here;
+					single.floors = 1;
+					chunk top(single);
+					chunkcache_generate(top);
+					for (int ty = 0; ty < top.height; ty++)
+						for (int tx = 0; tx < top.width; tx++)
+							assert(top.at(tx, ty) == ch.at(tx, ty) || (top.at(tx, ty) == TILE_EMPTY && ch.at(tx, ty) == TILE_STAIRS_DOWN));
+				}
+				else
+				{
+					chunkconfig above = here;
+					above.z = 0;
+					chunk other(above);
+					chunkcache_generate(other);
+					assert(other.hash() != ch.hash());
+				}
+			}
+		}
+	}
+	assert(links > 0);
+
+	// The view keeps the floor it is on, plus skeletons where stairs lead
+	chunkview v(c, 64, 32);
+	v.change_position(64, 64);
+	v.self_test();
+	for (int64_t cy = 1; cy <= 2; cy++)
+		for (int64_t cx = 1; cx <= 2; cx++)
+			assert(v.chunk_detail(cx * 32, cy * 32, 1) == (c.stairs(cx, cy, 0) ? DETAIL_SKELETON : DETAIL_NONE));
+	v.take_changes();
+	v.set_floor(1);
+	const chunkview_changes changes = v.take_changes();
+	assert(v.floor() == 1 && changes.full);
+	v.self_test();
+	assert(v.chunk_detail(64, 64) == DETAIL_FULL && v.chunk_detail(64, 64, 2) == (c.stairs(2, 2, 1) ? DETAIL_SKELETON : DETAIL_NONE));
+	for (int64_t cy = 1; cy <= 2; cy++)
+		for (int64_t cx = 1; cx <= 2; cx++)
+			assert(v.chunk_detail(cx * 32, cy * 32, 0) == (c.stairs(cx, cy, 0) ? DETAIL_FULL : DETAIL_NONE)); // kept for the way back
+	const viewport_span vp = v.viewport();
+	for (int yy = 0; yy < vp.height; yy++) for (int xx = 0; xx < vp.width; xx++) assert(vp.at(xx, yy) == v.get_tile(vp.x + xx, vp.y + yy));
+	v.set_floor(0);
+	v.self_test();
+}
+
+// Seam processing may only turn walls that are buried in walls and rock on both sides of a seam into rock,
+// and views must show the result.
+static void beautified_generate(chunk& c, int from, int to)
+{
+	chunkcache_generate(c, from, to);
+	if (from < DETAIL_FULL && to >= DETAIL_FULL)
+	{
+		chunk_filter_room_in_room(c);
+		c.beautify(); // leaves a band along the borders alone
+	}
+}
+
+static int seams_walk(uint64_t value)
+{
+	seed s(value);
+	chunkconfig c(s);
+	c.level_width = 6;
+	c.level_height = 6;
+	chunkcache plain_cache(c, beautified_generate);
+	chunkview plain(plain_cache, 96, 64);
+	const bool refused = !plain.set_seams(true); // the cache could be shared with other views
+	assert(refused);
+	chunkview seamed(c, 96, 64, beautified_generate);
+	const bool seams = seamed.set_seams(true);
+	assert(seams);
+	(void)refused;
+	(void)seams;
+	shadow_view sh = { std::vector<int>(96 * 64, -1), 96, 64 };
+	int changed = 0;
+	for (int64_t x = 48; x < 6 * 32; x += 7)
+	{
+		const int64_t y = 32 + (x % 64);
+		plain.change_position(x, y);
+		seamed.change_position(x, y);
+		seamed.self_test();
+		sh.update(seamed);
+		for (int yy = 0; yy < 64; yy++)
+		{
+			for (int xx = 0; xx < 96; xx++)
+			{
+				const int64_t wx = seamed.view_x() + xx;
+				const int64_t wy = seamed.view_y() + yy;
+				const tile_type a = plain.get_tile(wx, wy);
+				const tile_type b = seamed.get_tile(wx, wy);
+				assert(sh.cells[yy * 96 + xx] == b);
+				if (a == b) continue;
+				assert(a == TILE_WALL && b == TILE_ROCK);
+				assert(wx % 32 < 2 || wx % 32 >= 30 || wy % 32 < 2 || wy % 32 >= 30);
+				changed++;
+			}
+		}
+	}
+	return changed;
+}
+
+static void seams_test()
+{
+	int changed = 0;
+	for (uint64_t value = 19; value < 27; value++) changed += seams_walk(value);
+	assert(changed > 0);
+
+	// Doing a seam again changes nothing
+	seed s(5);
+	chunkconfig c(s);
+	chunkconfig left = c;
+	left.x = 1;
+	left.y = 1;
+	chunkconfig right = left;
+	right.x = 2;
+	chunk a(left), b(right);
+	beautified_generate(a, DETAIL_NONE, DETAIL_FULL);
+	beautified_generate(b, DETAIL_NONE, DETAIL_FULL);
+	a.build_mip();
+	b.build_mip();
+	chunk_filter_seam(a, b, DIR_RIGHT);
+	chunk rebuilt = a;
+	rebuilt.build_mip();
+	for (int level = 0; level < chunkmip::LEVELS; level++) assert(rebuilt.mip.cells[level] == a.mip.cells[level]);
+	assert((a.seams & DIR_RIGHT) && (b.seams & DIR_LEFT));
+	const int again = chunk_filter_seam(a, b, DIR_RIGHT);
+	assert(again == 0);
+	(void)again;
+}
 
 int main()
 {
+	chunk_trace_init_from_env(); // set CHUNKY_TRACE=file.json to record a timeline
 	seed s(0);
 	chunkconfig c(s);
 	chunkview v(c, 64, 32);
@@ -17,5 +632,18 @@ int main()
 
 	v.self_test();
 
+	staged_generation_test();
+	lod_view_test();
+	changes_test();
+	viewport_test();
+	mip_test();
+	features_test();
+	entities_test();
+	reroll_test();
+	pack_test();
+	unbounded_test();
+	floors_test();
+	seams_test();
+
 	return 0;
 }